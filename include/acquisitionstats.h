@@ -0,0 +1,176 @@
+/*
+  acquisitionstats.h
+  Counters and histograms monitoring the data acquisition.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _ACQUISITIONSTATS_H_
+#define _ACQUISITIONSTATS_H_ 1
+
+#include <string>
+#include <relacs/options.h>
+#include "configdata.h"
+
+using namespace std;
+using namespace relacs;
+
+
+/*!
+\class AcquisitionStats
+\brief Counters and histograms monitoring the data acquisition.
+\author Jan Benda
+
+The DataThread records the duration of each call of read(),
+the number of scans published by each call, the lag of the consumers
+behind the producer and the fill level of the input buffers as seen by the consumers,
+as well as overruns reported by the driver and restarts of the acquisition.
+Drivers that query the status of the device in addition to the data
+report the number and the cost of these queries, drivers reading
+from several devices the skew between them.
+This allows to tell whether lost data are due to the driver,
+the input buffers, or the consumers.
+
+AcquisitionStats does not lock, the DataThread protects it by a mutex.
+*/
+
+class AcquisitionStats
+{
+
+public:
+
+  /*!
+  \class Histogram
+  \brief Histogram of non-negative integer values with logarithmic bins.
+
+  Bin 0 counts values smaller than one,
+  bin \a k counts values from 2^(k-1) to 2^k - 1.
+  */
+  class Histogram
+  {
+
+  public:
+
+    Histogram( void );
+      /*! Remove all values. */
+    void clear( void );
+      /*! Add the value \a x to the histogram. */
+    void add( long long x );
+
+      /*! The number of values added to the histogram. */
+    long long count( void ) const;
+      /*! The mean of all values. */
+    double mean( void ) const;
+      /*! The maximum value. */
+    long long max( void ) const;
+      /*! An upper bound for the \a p quantile (0 <= \a p <= 1),
+          i.e. the upper edge of the bin containing the quantile. */
+    long long quantile( double p ) const;
+      /*! Count, mean, median, 99% quantile and maximum as a string
+          with values followed by \a unit. */
+    string str( const string &unit="" ) const;
+
+      /*! The number of bins. */
+    static const int Bins = 48;
+
+
+  private:
+
+    long long Counts[Bins];
+    long long Count;
+    double Sum;
+    long long Max;
+
+  };
+
+
+  AcquisitionStats( void );
+
+    /*! Reset all counters and histograms and set the start time
+        to \a time microseconds. */
+  void clear( long long time );
+
+    /*! The current time of a monotonic clock in microseconds. */
+  static long long microseconds( void );
+
+    /*! Add a call of read() that took \a time microseconds
+        and published \a scans scans. */
+  void addRead( long long time, long long scans );
+    /*! A consumer of grid \a g is \a lag scans behind the producer
+        in an input buffer that holds \a capacity scans. */
+  void addLag( int g, long long lag, long long capacity );
+    /*! Count an overrun reported by the driver. */
+  void addOverrun( void );
+    /*! Count a restart of the data acquisition. */
+  void addRestart( void );
+    /*! Add \a checks queries of the device status
+        that took \a time microseconds altogether. */
+  void addStatusChecks( long long checks, long long time );
+    /*! Add the difference \a scans in scans available from
+        several synchronized devices. */
+  void addSkew( long long scans );
+
+    /*! Histogram of the durations of read() in microseconds. */
+  const Histogram &readTime( void ) const;
+    /*! Histogram of the number of scans published by read(). */
+  const Histogram &readScans( void ) const;
+    /*! Histogram of the lags of the consumers of grid \a g in scans. */
+  const Histogram &lag( int g ) const;
+    /*! The most recent fill level of the input buffer of grid \a g
+        as seen by its consumers, as a fraction of its capacity. */
+  double fill( int g ) const;
+    /*! The maximum fill level of the input buffer of grid \a g
+        as seen by its consumers, as a fraction of its capacity. */
+  double maxFill( int g ) const;
+    /*! The number of overruns reported by the driver. */
+  long long overruns( void ) const;
+    /*! The number of restarts of the data acquisition. */
+  long long restarts( void ) const;
+    /*! The number of queries of the device status. */
+  long long statusChecks( void ) const;
+    /*! The total time in microseconds spent in queries of the device status. */
+  long long statusTime( void ) const;
+    /*! Histogram of the skew between several devices in scans. */
+  const Histogram &skew( void ) const;
+    /*! The average number of scans per second published
+        since clear() up to \a time microseconds. */
+  double throughput( long long time ) const;
+
+    /*! Add all counters and histograms as text parameters
+        to \a opts. \a time is the current time in microseconds. */
+  void options( Options &opts, long long time ) const;
+
+
+private:
+
+  long long StartTime;
+  Histogram ReadTime;
+  Histogram ReadScans;
+  Histogram Lag[ConfigData::MaxGrids];
+  double Fill[ConfigData::MaxGrids];
+  double MaxFill[ConfigData::MaxGrids];
+  long long Overruns;
+  long long Restarts;
+  long long StatusChecks;
+  long long StatusTime;
+  Histogram Skew;
+
+};
+
+
+#endif /* ! _ACQUISITIONSTATS_H_ */
+
@@ -0,0 +1,113 @@
+/*
+  boardoffsets.h
+  Estimates the temporal offsets between acquisition boards.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _BOARDOFFSETS_H_
+#define _BOARDOFFSETS_H_ 1
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+/*!
+\class BoardOffsets
+\brief Estimates the temporal offsets between acquisition boards.
+\author Jan Benda
+
+The channels of all grids are acquired by several boards, the first
+boardChannels( 0 ) channels by the first board, the next ones by the
+second board, and so on. Signals common to all electrodes, like
+mains hum or the electric organ discharges of the fish, show up on
+the channels of all boards. estimate() averages the channels of each
+board into a common-mode signal and cross-correlates the common-mode
+signal of each board with the one of the first board via FFTs.
+The lag of the maximum correlation within maxLag() scans is the
+offset() of the board in scans: sample \a i of the first board
+corresponds to sample \a i + offset() of the other board.
+This is the meaning of the "offset" options of the acquisition
+used for browsing recorded data.
+*/
+
+class BoardOffsets
+{
+
+public:
+
+    /*! Constructs an estimator without boards. */
+  BoardOffsets( void );
+
+    /*! Set the number of channels of each board. */
+  void setBoards( const vector< int > &boardchannels );
+    /*! The number of boards. */
+  int boards( void ) const;
+    /*! The number of channels of board \a b. */
+  int boardChannels( int b ) const;
+
+    /*! Set the maximum offset searched for to \a maxlag scans. */
+  void setMaxLag( int maxlag );
+    /*! The maximum offset searched for in scans. */
+  int maxLag( void ) const;
+
+    /*! Estimate the offsets from \a scans scans of \a channels
+        interleaved channels in \a data.
+        \return 0 on success, -1 if there are less than two boards
+	or the boards need more than \a channels channels. */
+  int estimate( const float *data, int channels, int scans );
+
+    /*! The offset of board \a b relative to the first board in scans. */
+  int offset( int b ) const;
+    /*! The correlation coefficient of the common-mode signal of board \a b
+        with the one of the first board at offset(). */
+  double correlation( int b ) const;
+
+    /*! The lag at which \a y is most similar to \a x, i.e. y[i+lag]
+        correlates best with x[i], searched within \a maxlag.
+	Both signals need to have the same size. \a corr is set to
+	the correlation coefficient at this lag. */
+  static int lag( const vector< double > &x, const vector< double > &y,
+		  int maxlag, double &corr );
+
+    /*! Rewrite the "offset" options of the Acquisition section
+        in the configuration file \a configfile to \a offsets
+	and, if \a channeloffsets is not empty, the "ChannelOffset"
+	options of the FishGrid section to \a channeloffsets.
+        \return 0 on success, -1 if the file could not be read. */
+  static int saveOffsets( const string &configfile, const vector< int > &offsets,
+			  const vector< int > &channeloffsets=vector< int >() );
+
+
+private:
+
+    /*! In-place radix-2 FFT of the complex data \a re + i \a im.
+        The size of the data must be a power of two. */
+  static void fft( vector< double > &re, vector< double > &im, bool inverse );
+
+  vector< int > BoardChannels;
+  int MaxLag;
+  vector< int > Offsets;
+  vector< double > Correlations;
+
+};
+
+
+#endif /* ! _BOARDOFFSETS_H_ */
+
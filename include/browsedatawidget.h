@@ -51,6 +51,7 @@ Navigation:
 - \c > : Increase channel offset of current grid (for debugging)
 - \c CRTL \c < : Decrease temporal offset of second board (for debugging)
 - \c CRTL \c > : Increase temporal offset of second board (for debugging)
+- \c CRTL \c O : Estimate temporal offsets of the boards from the common-mode signals
 
 Time stamps:
 - \c 1, \c  2, ... \c 9 : Jump to time stamp 1, 2, ... 9, respectively
@@ -79,6 +80,9 @@ public:
   void saveData( void );
     /*! Save changed channel and temporal offsets into current configuration file. */
   void saveOffsets( void );
+    /*! Estimate the temporal offsets of the boards from \a time seconds
+        of data starting at the current position. */
+  void estimateOffsets( double time=4.0 );
 
 
 public slots:
@@ -0,0 +1,151 @@
+/*
+  comedistream.h
+  Drains the analog input data of a Comedi device into a staging buffer.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _COMEDISTREAM_H_
+#define _COMEDISTREAM_H_ 1
+
+#include <climits>
+#include <string>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSemaphore>
+#include <comedilib.h>
+#include "cyclicbuffer.h"
+#include "acquisitionstats.h"
+
+using namespace std;
+
+
+/*!
+\class ComediStream
+\brief Drains the analog input data of a Comedi device into a staging buffer.
+\author Jan Benda
+
+This is the first stage of the acquisition pipeline of ComediThread.
+A dedicated thread waits for the data of a running comedi command
+and copies the raw bytes of whole scans, either by read() or
+from comedi's mapped buffer, into a large CyclicBuffer.
+It does nothing else, so that comedi's buffer is emptied as fast
+as possible and the conversion and demultiplexing of the data in the
+acquisition thread can not delay it.
+
+The acquisition thread follows the buffer() with a
+CyclicBufferReader and waits for new data by waitForData().
+A failed access of the device, in particular an overflow of comedi's
+buffer (EPIPE), stops the stream and is reported by error().
+If the device stopped acquiring data and all of them were drained,
+running() returns \c false.
+*/
+
+class ComediStream : public QThread
+{
+
+public:
+
+    /*! Constructs an idle stream. */
+  ComediStream( void );
+    /*! Stops the stream. */
+  ~ComediStream( void );
+
+    /*! Run the stream thread with scheduling \a policy and
+        \a priority (see pthread_setschedparam()).
+	Takes effect with the next startStream(),
+	which returns after the scheduling has been applied. */
+  void setScheduling( int policy, int priority );
+
+    /*! Allocate a staging buffer of at least \a buffersize bytes
+        and start draining the data of \a subdevice of \a device.
+	\a mapbuffer is comedi's buffer of \a mapsize bytes mapped into memory,
+	or null if the data should be copied by read().
+	Only whole scans of \a scansize bytes are transferred.
+	The thread waits until \a wakesize bytes are available,
+	but not longer than \a polltimeout microseconds.
+	\a rate is the number of bytes acquired per second.
+        \return 0 on success, -1 on invalid arguments. */
+  int startStream( comedi_t *device, unsigned int subdevice,
+		   char *mapbuffer, int mapsize, int scansize, double rate,
+		   int wakesize, long long polltimeout, long long buffersize );
+    /*! Stop the stream thread. The data in the buffer are kept. */
+  void stopStream( void );
+    /*! \c true if the stream thread is running. */
+  bool streaming( void ) const;
+
+    /*! The buffer the raw bytes are written into. */
+  const CyclicBuffer< char > &buffer( void ) const;
+    /*! Wait until the buffer holds more than \a index bytes,
+        the stream failed or finished, or \a time milliseconds passed.
+	\return \c true if data beyond \a index are available. */
+  bool waitForData( long long index, unsigned long time=ULONG_MAX );
+
+    /*! The error code (errno) of the first failed access of the device,
+        zero if none. */
+  int error( void ) const;
+    /*! \c false if the device stopped acquiring data and
+        all of its data have been drained. */
+  bool running( void ) const;
+    /*! The number of transfers from the device into the buffer. */
+  long long transfers( void ) const;
+    /*! A message why the requested scheduling was denied
+        to the stream thread, empty if it was granted. */
+  string schedulingError( void ) const;
+
+
+protected:
+
+    /*! The loop draining the device. */
+  virtual void run( void );
+
+
+private:
+
+    /*! Copy \a n bytes from the device into the buffer.
+        If the device delivers less than \a n bytes, the failure is EIO.
+        \return 0 on success, -1 on failure. */
+  int transfer( int n );
+    /*! Record the failure \a ern and wake up waiting threads. */
+  void setError( int ern );
+
+  comedi_t *Device;
+  unsigned int SubDevice;
+  char *MapBuffer;
+  int MapSize;
+  int ScanSize;
+  double Rate;
+  int WakeSize;
+  long long PollTimeout;
+  CyclicBuffer< char > Buffer;
+  int Policy;
+  int Priority;
+  string SchedulingError;
+  bool Stop;
+  int Error;
+  bool Running;
+  long long Transfers;
+  mutable QMutex Mutex;
+  QWaitCondition DataCondition;
+  QSemaphore Scheduled;
+
+};
+
+
+#endif /* ! _COMEDISTREAM_H_ */
+
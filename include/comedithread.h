@@ -22,7 +22,12 @@
 #ifndef _COMEDITHREAD_H_
 #define _COMEDITHREAD_H_ 1
 
+#include <vector>
 #include <comedilib.h>
+#include "comedistream.h"
+#include "cyclicbufferreader.h"
+#include "converter.h"
+#include "demuxplan.h"
 #include "datathread.h"
 
 using namespace std;
@@ -32,6 +37,24 @@ using namespace std;
 \class ComediThread
 \brief DataThread implementation for acquisition of data using Comedi
 \author Jan Benda
+
+The "pipeline" option, disabled by default, splits the acquisition
+into two stages. For each device a ComediStream drains comedi's
+buffer into a large staging buffer of raw samples, and read() only converts and
+demultiplexes the staged data into the input buffers of the grids.
+A slow conversion then merely fills the staging buffer, but does not
+let comedi's buffer overflow. Without the "pipeline" option read()
+takes the data directly from the devices.
+
+The "converter" option selects how raw counts are converted to floats
+if the input buffers do not store raw counts. "polynomial" evaluates
+the calibration polynomials with SSE or AVX instructions.
+"lookuptable" looks up the values in tables of all 65536 raw counts,
+see Converter::setLookupTable(), and is only used for devices
+with at most 16 bits. Whether this pays off depends on the machine:
+on a CPU with SSE2 but without AVX2 the lookup ran at only 0.45 times
+the speed of the polynomial in fishgridbenchconvert. Run this program
+before choosing "lookuptable".
 */
 
 class ComediThread : public DataThread
@@ -44,6 +67,7 @@ public:
 
 protected:
 
+  virtual bool rawInputSupported( void );
   virtual int initialize( double duration=0.0 );
   virtual void finish( void );
   virtual int read( void );
@@ -51,6 +75,30 @@ protected:
 
 private:
 
+    /*! Sleep until at least WakeSize bytes are available on every
+        device or until PollTimeout passed.
+        Devices without any data are waited for by poll().
+        \return 0 on success, -1 if poll() failed. */
+  int waitForDevices( void );
+    /*! Convert and copy \a scans whole scans of raw data of device \a j,
+        beginning \a from scans after the element \a start of \a source,
+        via Plan to \a fp or, for raw input, \a rp.
+	Handles the wrap-around of comedi's mapped buffer. */
+  template < class S >
+  void transferScans( int j, const S *source, int start, int from, int scans,
+		      float **fp, RawSample **rp );
+    /*! Start the ComediStream of each device.
+        \return 0 on success, -1 on failure. */
+  int startStreams( void );
+    /*! The read() of the second stage of the pipeline,
+        taking the data from the staging buffers of the Streams. */
+  int readStreams( void );
+    /*! Convert and copy \a scans whole scans of the staged samples of
+        device \a j, beginning \a from scans after the read index,
+	via Plan to \a fp or, for raw input, \a rp. */
+  template < class S >
+  void transferStream( int j, int from, int scans, float **fp, RawSample **rp );
+
     /*! Number of comedi devices in use. */
   int NDevices;
     /*! Maximum number of comedi device supportet. */
@@ -77,14 +125,30 @@ private:
   unsigned int BufferElemSize[MaxDevices];
     /*! Size of the internal buffers used for getting the data from the driver (in bytes). */
   int BufferSize[MaxDevices];
-    /*! Number of bytes in the internal buffers used for getting the data from the driver. */
-  int NBuffer[MaxDevices];
     /*! The internal buffers used for getting the data from the driver. */
   char *Buffer[MaxDevices];
-    /*! Index of current device for writing data into the buffer. */
-  int DeviceInx;
-    /*! Index of current channel of current device for writing data into the buffer. */
-  int ChannelInx;
+    /*! Comedi's buffer mapped into memory, or null if data are copied by read(). */
+  char *MapBuffer[MaxDevices];
+    /*! The size of the mapped buffer in bytes. */
+  int MapSize[MaxDevices];
+    /*! The minimum number of bytes per device waitForDevices() waits for. */
+  int WakeSize[MaxDevices];
+    /*! The maximum time waitForDevices() waits in microseconds. */
+  long long PollTimeout;
+    /*! Conversion of the raw counts of each device into voltages. */
+  Converter Converters[MaxDevices];
+    /*! The data of Buffer converted into voltages. */
+  vector< float > Converted[MaxDevices];
+    /*! The routing of the channels of all devices to the grids. */
+  DemuxPlan Plan;
+    /*! True if the data are drained by the Streams. */
+  bool Pipeline;
+    /*! The first stage of the pipeline, draining the devices. */
+  ComediStream Streams[MaxDevices];
+    /*! The read position in the staging buffers of the Streams in bytes. */
+  CyclicBufferReader Readers[MaxDevices];
+    /*! The maximum time in milliseconds readStreams() waits for data. */
+  unsigned long WaitTime;
 
 };
 
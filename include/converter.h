@@ -0,0 +1,338 @@
+/*
+  converter.h
+  Conversion of raw ADC counts to physical units.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CONVERTER_H_
+#define _CONVERTER_H_ 1
+
+#include <vector>
+#if defined( __SSE2__ )
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+
+/*!
+\class Converter
+\brief Conversion of raw ADC counts to physical units.
+\author Jan Benda
+
+A Converter holds a calibration polynomial of up to third order
+for each of the channels() channels that are multiplexed into a stream
+of raw ADC counts:
+\f[ y = c_0 + c_1 d + c_2 d^2 + c_3 d^3 \quad \mathrm{with} \quad d = x - x_0 \f]
+where \f$ x \f$ is the raw count and \f$ x_0 \f$ the expansion origin.
+A scale factor, like the inverse gain of the amplifiers, is folded
+into the coefficients by setPolynomial().
+
+convert() converts a stream of interleaved data elements, i.e.
+the data of all channels of one scan followed by the next scan.
+Complete scans are converted by evaluating the polynomials of all
+channels at once with SSE or AVX instructions, if the code is compiled
+for them (\c __SSE2__ or \c __AVX2__ defined, e.g. by -march=native).
+Otherwise a scalar loop is used.
+convertChannel() converts a contiguous run of data elements of a single channel.
+
+The kernels are templates on the sample type. \c unsigned \c short
+(comedi's sampl_t), \c short (NIDAQmx's int16) and \c unsigned \c int
+(lsampl_t) are loaded directly into vector registers, other types are
+converted element by element.
+The polynomials are evaluated in single precision,
+which is sufficient for the resolution of the ADCs.
+
+Alternatively, for ADCs with at most 16 bits, setLookupTable()
+tabulates the polynomials for all 65536 possible raw counts.
+Channels with identical polynomials share a table. convert() and
+convertChannel() then look up the converted values of unsigned raw
+counts, using AVX2 gathers if available. Signed raw counts (\c short)
+are always converted by evaluating the polynomials, since the tables
+are indexed by unsigned counts.
+Whether the lookup is faster than evaluating the polynomials depends
+on the instruction set, the number of distinct tables, and the cache
+sizes of the machine; see the fishgridbenchconvert program.
+*/
+
+class Converter
+{
+
+public:
+
+    /*! Constructs a Converter without channels. */
+  Converter( void );
+    /*! Constructs a Converter for \a channels channels with the identity
+        as calibration polynomial. */
+  Converter( int channels );
+
+    /*! The number of channels. */
+  int channels( void ) const;
+    /*! Set the number of channels to \a channels and reset all
+        calibration polynomials to the identity. */
+  void setChannels( int channels );
+    /*! Set the calibration polynomial of channel \a c to
+        \a coeffs[0] + \a coeffs[1]*d + ... + \a coeffs[order]*d^order
+	with d = x - \a origin. All coefficients are multiplied by \a scale.
+	\a order must not exceed three. */
+  void setPolynomial( int c, int order, double origin, const double *coeffs,
+		      double scale=1.0 );
+    /*! The highest order of all calibration polynomials
+        with non-zero coefficients. */
+  int order( void ) const;
+
+    /*! The number of entries of a lookup table. */
+  static const int TableSize = 65536;
+    /*! Tabulate the calibration polynomials for all TableSize raw counts.
+        From now on convert() and convertChannel() use the lookup tables
+	for unsigned raw counts. Only the lower 16 bits of the raw counts
+	are used. Signed raw counts are still converted by the polynomials.
+	setChannels() and setPolynomial() remove the tables again. */
+  void setLookupTable( void );
+    /*! Remove the lookup tables and evaluate the polynomials again. */
+  void clearLookupTable( void );
+    /*! \c true if the conversion uses lookup tables. */
+  bool lookupTable( void ) const;
+    /*! The number of distinct lookup tables. */
+  int tables( void ) const;
+
+    /*! Convert the single raw count \a x of channel \a c. */
+  inline float convert( float x, int c ) const;
+    /*! Convert the \a n interleaved raw counts \a in into \a out.
+        The first element in \a in belongs to channel \a c. */
+  template < class T >
+  void convert( const T *in, float *out, long long n, int c=0 ) const;
+    /*! Convert the \a n raw counts \a in of channel \a c into \a out. */
+  template < class T >
+  void convertChannel( const T *in, float *out, long long n, int c ) const;
+
+
+private:
+
+    /*! Convert the channels() raw counts of a complete scan. */
+  template < class T >
+  void convertScan( const T *in, float *out ) const;
+    /*! Look up the channels() raw counts of a complete scan. */
+  template < class T >
+  void lookupScan( const T *in, float *out ) const;
+    /*! The index of raw count \a x into a lookup table. */
+  template < class T >
+  static inline int code( T x ) { return ((unsigned int)x) & 0xffff; };
+    /*! \c true if raw counts of type \a T are looked up in the tables,
+        i.e. if \a T is an unsigned integer type. */
+  template < class T >
+  bool tabulated( void ) const { return ! Tables.empty() && (T)-1 > (T)0; };
+
+#if defined( __AVX2__ )
+  typedef __m256 Vector;
+  static const int Width = 8;
+  static inline Vector load( const float *p ) { return _mm256_loadu_ps( p ); };
+  static inline Vector set( float x ) { return _mm256_set1_ps( x ); };
+  static inline Vector add( Vector a, Vector b ) { return _mm256_add_ps( a, b ); };
+  static inline Vector sub( Vector a, Vector b ) { return _mm256_sub_ps( a, b ); };
+  static inline Vector mul( Vector a, Vector b ) { return _mm256_mul_ps( a, b ); };
+  static inline void store( float *p, Vector a ) { _mm256_storeu_ps( p, a ); };
+  static inline Vector load( const unsigned short *p )
+    { return _mm256_cvtepi32_ps( _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i*)p ) ) ); };
+  static inline Vector load( const short *p )
+    { return _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( _mm_loadu_si128( (const __m128i*)p ) ) ); };
+  static inline Vector load( const unsigned int *p )
+    { return _mm256_cvtepi32_ps( _mm256_loadu_si256( (const __m256i*)p ) ); };
+  template < class T >
+  static inline Vector load( const T *p )
+    { return _mm256_setr_ps( p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7] ); };
+  static inline __m256i loadCodes( const unsigned short *p )
+    { return _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i*)p ) ); };
+  static inline __m256i loadCodes( const unsigned int *p )
+    { return _mm256_and_si256( _mm256_loadu_si256( (const __m256i*)p ), _mm256_set1_epi32( 0xffff ) ); };
+  template < class T >
+  static inline __m256i loadCodes( const T *p )
+    { return _mm256_setr_epi32( code( p[0] ), code( p[1] ), code( p[2] ), code( p[3] ),
+				code( p[4] ), code( p[5] ), code( p[6] ), code( p[7] ) ); };
+#elif defined( __SSE2__ )
+  typedef __m128 Vector;
+  static const int Width = 4;
+  static inline Vector load( const float *p ) { return _mm_loadu_ps( p ); };
+  static inline Vector set( float x ) { return _mm_set1_ps( x ); };
+  static inline Vector add( Vector a, Vector b ) { return _mm_add_ps( a, b ); };
+  static inline Vector sub( Vector a, Vector b ) { return _mm_sub_ps( a, b ); };
+  static inline Vector mul( Vector a, Vector b ) { return _mm_mul_ps( a, b ); };
+  static inline void store( float *p, Vector a ) { _mm_storeu_ps( p, a ); };
+  static inline Vector load( const unsigned short *p )
+    { return _mm_cvtepi32_ps( _mm_unpacklo_epi16( _mm_loadl_epi64( (const __m128i*)p ),
+						  _mm_setzero_si128() ) ); };
+  static inline Vector load( const short *p )
+    { return _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpacklo_epi16( _mm_setzero_si128(),
+								 _mm_loadl_epi64( (const __m128i*)p ) ), 16 ) ); };
+  static inline Vector load( const unsigned int *p )
+    { return _mm_cvtepi32_ps( _mm_loadu_si128( (const __m128i*)p ) ); };
+  template < class T >
+  static inline Vector load( const T *p )
+    { return _mm_setr_ps( p[0], p[1], p[2], p[3] ); };
+#endif
+
+    /*! The expansion origins. */
+  vector< float > Origin;
+    /*! The coefficients of the polynomials, one vector for each order. */
+  vector< float > Coefficients[4];
+    /*! The highest order with non-zero coefficients. */
+  int Order;
+    /*! The lookup tables, one after the other. */
+  vector< float > Tables;
+    /*! For each channel the index of its lookup table in Tables. */
+  vector< int > TableOffset;
+
+};
+
+
+inline float Converter::convert( float x, int c ) const
+{
+  float d = x - Origin[c];
+  if ( Order <= 1 )
+    return Coefficients[0][c] + d*Coefficients[1][c];
+  return Coefficients[0][c] + d*( Coefficients[1][c]
+				  + d*( Coefficients[2][c] + d*Coefficients[3][c] ) );
+}
+
+
+template < class T >
+void Converter::convertScan( const T *in, float *out ) const
+{
+  int nc = Origin.size();
+  int k = 0;
+#if defined( __SSE2__ )
+  const float *o = &Origin[0];
+  const float *c0 = &Coefficients[0][0];
+  const float *c1 = &Coefficients[1][0];
+  if ( Order <= 1 ) {
+    for ( ; k+Width <= nc; k += Width ) {
+      Vector d = sub( load( in+k ), load( o+k ) );
+      store( out+k, add( load( c0+k ), mul( d, load( c1+k ) ) ) );
+    }
+  }
+  else {
+    const float *c2 = &Coefficients[2][0];
+    const float *c3 = &Coefficients[3][0];
+    for ( ; k+Width <= nc; k += Width ) {
+      Vector d = sub( load( in+k ), load( o+k ) );
+      Vector y = add( load( c2+k ), mul( d, load( c3+k ) ) );
+      y = add( load( c1+k ), mul( d, y ) );
+      store( out+k, add( load( c0+k ), mul( d, y ) ) );
+    }
+  }
+#endif
+  for ( ; k<nc; k++ )
+    out[k] = convert( in[k], k );
+}
+
+
+template < class T >
+void Converter::lookupScan( const T *in, float *out ) const
+{
+  int nc = TableOffset.size();
+  const int *offs = &TableOffset[0];
+  const float *tables = &Tables[0];
+  int k = 0;
+#if defined( __AVX2__ )
+  for ( ; k+Width <= nc; k += Width ) {
+    __m256i inx = _mm256_add_epi32( loadCodes( in+k ),
+				    _mm256_loadu_si256( (const __m256i*)( offs+k ) ) );
+    store( out+k, _mm256_i32gather_ps( tables, inx, 4 ) );
+  }
+#endif
+  for ( ; k<nc; k++ )
+    out[k] = tables[offs[k] + code( in[k] )];
+}
+
+
+template < class T >
+void Converter::convert( const T *in, float *out, long long n, int c ) const
+{
+  int nc = Origin.size();
+  long long k = 0;
+  if ( tabulated< T >() ) {
+    const int *offs = &TableOffset[0];
+    const float *tables = &Tables[0];
+    for ( ; k<n && c > 0; k++ ) {
+      out[k] = tables[offs[c] + code( in[k] )];
+      if ( ++c >= nc )
+	c = 0;
+    }
+    for ( ; k+nc <= n; k += nc )
+      lookupScan( in+k, out+k );
+    for ( c=0; k<n; k++, c++ )
+      out[k] = tables[offs[c] + code( in[k] )];
+    return;
+  }
+  // up to the beginning of the next scan:
+  for ( ; k<n && c > 0; k++ ) {
+    out[k] = convert( in[k], c );
+    if ( ++c >= nc )
+      c = 0;
+  }
+  // complete scans:
+  for ( ; k+nc <= n; k += nc )
+    convertScan( in+k, out+k );
+  // beginning of the last scan:
+  for ( c=0; k<n; k++, c++ )
+    out[k] = convert( in[k], c );
+}
+
+
+template < class T >
+void Converter::convertChannel( const T *in, float *out, long long n, int c ) const
+{
+  long long k = 0;
+  if ( tabulated< T >() ) {
+    const float *table = &Tables[TableOffset[c]];
+#if defined( __AVX2__ )
+    for ( ; k+Width <= n; k += Width )
+      store( out+k, _mm256_i32gather_ps( table, loadCodes( in+k ), 4 ) );
+#endif
+    for ( ; k<n; k++ )
+      out[k] = table[code( in[k] )];
+    return;
+  }
+#if defined( __SSE2__ )
+  Vector o = set( Origin[c] );
+  Vector c0 = set( Coefficients[0][c] );
+  Vector c1 = set( Coefficients[1][c] );
+  Vector c2 = set( Coefficients[2][c] );
+  Vector c3 = set( Coefficients[3][c] );
+  if ( Order <= 1 ) {
+    for ( ; k+Width <= n; k += Width ) {
+      Vector d = sub( load( in+k ), o );
+      store( out+k, add( c0, mul( d, c1 ) ) );
+    }
+  }
+  else {
+    for ( ; k+Width <= n; k += Width ) {
+      Vector d = sub( load( in+k ), o );
+      Vector y = add( c2, mul( d, c3 ) );
+      y = add( c1, mul( d, y ) );
+      store( out+k, add( c0, mul( d, y ) ) );
+    }
+  }
+#endif
+  for ( ; k<n; k++ )
+    out[k] = convert( in[k], c );
+}
+
+
+#endif /* ! _CONVERTER_H_ */
+
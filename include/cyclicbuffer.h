@@ -23,11 +23,90 @@
 #define _CYCLICBUFFER_H_ 1
 
 #include <cstdlib>
+#include <climits>
 #include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
 #include <iostream>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 using namespace std;
 
 
+/*!
+\class CyclicBufferBase
+\brief The sizes and indices of a CyclicBuffer, independent of its data type.
+\author Jan Benda
+
+Consumers that only need to know which data elements are available,
+like CyclicBufferReader, can work on this base class
+irrespective of the type of the data stored in the CyclicBuffer.
+*/
+
+class CyclicBufferBase
+{
+
+  public:
+
+    /*! Creates an empty buffer. */
+  CyclicBufferBase( void ) : NBuffer( 0 ), Size( 0 ), Claimed( 0 ) {};
+    /*! The destructor. */
+  virtual ~CyclicBufferBase( void ) {};
+
+    /*! The size of the array, 
+        i.e. the total number of added data elements.
+        Can be larger than capacity()!
+        \sa accessibleSize(), empty() */
+  inline long long size( void ) const
+    { return __atomic_load_n( &Size, __ATOMIC_ACQUIRE ); };
+    /*! The index up to which the producer may be writing data elements,
+        i.e. size() plus the data elements claimed by the producer
+	but not published yet.
+        \sa minIndex() */
+  inline long long claimed( void ) const
+    { return __atomic_load_n( &Claimed, __ATOMIC_ACQUIRE ); };
+    /*! The number of data elements that are actually stored in the array
+        and therefore are accessible.
+        Less or equal than capacity() and size()!
+        \sa minIndex(), empty() */
+  inline long long accessibleSize( void ) const
+    { long long m = minIndex(); long long n = size(); return n > m ? n - m : 0; };
+    /*! The index of the first accessible data element.
+        Data elements that are currently overwritten by the producer
+	(see claimed()) are not accessible.
+        \sa accessibleSize() */
+  inline long long minIndex( void ) const
+    { long long n = claimed(); return n > NBuffer ? n - NBuffer : 0; };
+    /*! The minIndex() to be checked after data elements have been
+        copied out of the buffer. Copied data elements below this index
+	might have been overwritten by the producer while they were copied.
+        \sa minIndex() */
+  inline long long validIndex( void ) const
+    { __atomic_thread_fence( __ATOMIC_ACQUIRE ); return minIndex(); };
+    /*! True if the array does not contain any data elements,
+        i.e. size() equals zero.
+        \sa size(), accessibleSize() */
+  inline bool empty( void ) const { return size() == 0; };
+    /*! The capacity of the array, i.e. the number of data
+        elements for which memory has been allocated. */
+  inline long long capacity( void ) const { return NBuffer; };
+
+
+  protected:
+
+    /*! The capacity of the buffer. */
+  long long NBuffer;
+    /*! The number of data elements as published to readers. */
+  long long Size;
+    /*! The index up to which the producer may be writing. */
+  long long Claimed;
+
+};
+
+
 /*!
 \class CyclicBuffer
 \brief A template defining an one-dimensional cyclic array of data.
@@ -38,10 +117,39 @@ the standard template library, in that it is a
 random access container of objects of type \a T.
 The size() of CyclicBuffer, however, can exceed its capacity().
 Data elements below size()-capacity() are therefore not accessible.
+
+A single producer thread may add data via push() or pushBuffer() and
+push( int ) while other threads concurrently read size(), minIndex()
+and the data elements below size() without any locking.  The number
+of data elements is published by the producer only after the data
+have been written into the buffer (release semantics), and size()
+reads it with acquire semantics.  Before writing into pushBuffer()
+the producer claim()s the data elements it is going to write. They
+overwrite the oldest data elements, which are therefore excluded from
+minIndex() already while the producer is writing them. Readers
+copying data out of the buffer need to check afterwards whether the
+copied data elements are still at or above minIndex(), since the
+producer might have claimed them in the meantime.  All functions that change the
+structure of the buffer, like reserve(), resize(), clear(), or
+assign(), must not be called concurrently with any reader.
+
+With setMirrored() the buffer memory is mapped twice back to back
+into the virtual address space. Then any range of data elements up
+to capacity() is a single contiguous block of memory, spans() always
+returns a single span, and maxPush() is not truncated at the end of
+the buffer. Mirroring is only available on Linux (memfd_create()) and
+rounds the capacity up to a multiple of the page size. Memory mapped
+without mirroring keeps the capacity a multiple of the granularity
+passed to reserve().
+
+For real-time acquisition the buffer memory can be backed by
+huge pages (setHugePages()), locked into RAM (lock()), and
+touched once in advance (prefault()), so that the producer does not
+take a page fault on the first pass through the buffer.
 */
 
 template < class T = double >
-class CyclicBuffer
+class CyclicBuffer : public CyclicBufferBase
 {
 
   public:
@@ -49,7 +157,7 @@ class CyclicBuffer
     /*! Creates an empty CyclicBuffer. */
   CyclicBuffer( void );
     /*! Creates an empty array with capacity \a n data elements. */
-  CyclicBuffer( int n );
+  CyclicBuffer( long long n );
     /*! Copy constructor.
         Creates an CyclicBuffer with the same size and content as \a ca. */
   CyclicBuffer( const CyclicBuffer< T > &ca );
@@ -61,23 +169,6 @@ class CyclicBuffer
     /*! Assigns \a a to *this. */
   const CyclicBuffer<T> &assign( const CyclicBuffer<T> &a );
 
-    /*! The size of the array, 
-        i.e. the total number of added data elements.
-        Can be larger than capacity()!
-        \sa accessibleSize(), readSize(), empty() */
-  long long size( void ) const;
-    /*! The number of data elements that are actually stored in the array
-        and therefore are accessible.
-        Less or equal than capacity() and size()!
-        \sa minIndex(), readSize(), empty() */
-  int accessibleSize( void ) const;
-    /*! The index of the first accessible data element.
-        \sa accessibleSize() */
-  long long minIndex( void ) const;
-    /*! True if the array does not contain any data elements,
-        i.e. size() equals zero.
-        \sa size(), accessibleSize(), readSize() */
-  bool empty( void ) const;
     /*! Resize the array to \a n data elements
         such that the size() of the array equals \a n.
         Data values are preserved and new data values
@@ -91,9 +182,6 @@ class CyclicBuffer
         The capacity() remains unchanged. */
   virtual void clear( void );
 
-    /*! The capacity of the array, i.e. the number of data
-        elements for which memory has been allocated. */
-  int capacity( void ) const;
     /*! If \a n is less than or equal to capacity(), 
         this call has no effect. 
 	Otherwise, it is a request for allocation 
@@ -102,8 +190,64 @@ class CyclicBuffer
 	then capacity() is greater than or equal to \a n; 
 	otherwise, capacity() is unchanged. 
 	In either case, size() is unchanged and the content
-	of the array is preserved. */
-  virtual void reserve( int n );
+	of the array is preserved.
+	The capacity is a multiple of \a granularity, e.g. the number of
+	data elements of a scan, unless the memory is mirrored.
+	Then the producer can always push whole scans up to the end
+	of the buffer. Memory that is mapped in multiples of pages
+	beyond the capacity is left unused. */
+  virtual void reserve( long long n, int granularity=1 );
+    /*! Request the buffer memory to be mapped twice back to back
+        (\a mirrored = \c true) or to be allocated on the heap.
+        If the mode changes, the buffer memory is released,
+	all data are discarded, and the capacity() is set to zero.
+	The mode takes effect with the next call of reserve().
+	If the mirrored mapping can not be established,
+	reserve() falls back to heap memory.
+        \sa mirrored() */
+  void setMirrored( bool mirrored );
+    /*! \c true if the buffer memory is mapped twice back to back.
+        \sa setMirrored() */
+  bool mirrored( void ) const;
+
+    /*! Policies for backing the buffer memory with huge pages.
+        \sa setHugePages() */
+  enum HugePagesPolicy {
+      /*! Use normal pages. */
+    NoHugePages=0,
+      /*! Advise the kernel to use transparent huge pages. */
+    TransparentHugePages=1,
+      /*! Use huge pages from the explicitly reserved pool (hugetlbfs). */
+    ExplicitHugePages=2
+  };
+    /*! Request the buffer memory to be backed by huge pages
+        according to \a policy (one of HugePagesPolicy).
+        If the policy changes, the buffer memory is released,
+	all data are discarded, and the capacity() is set to zero.
+	The policy takes effect with the next call of reserve().
+	Explicit huge pages round the capacity up to a multiple of the
+	huge page size. If they are not available, reserve() falls back
+	to normal pages.
+        \sa hugePages() */
+  void setHugePages( int policy );
+    /*! The policy of huge pages that is actually applied to the
+        current buffer memory.
+        \sa setHugePages() */
+  int hugePages( void ) const;
+    /*! Lock the buffer memory, including its mirror, into RAM (mlock()).
+        The lock is kept until unlock() is called or the memory is released.
+	\return 0 on success, otherwise the errno of mlock().
+        \sa lockedSize(), prefault() */
+  int lock( void );
+    /*! Unlock the buffer memory.
+        \sa lock() */
+  void unlock( void );
+    /*! The number of bytes of the buffer memory locked by lock(). */
+  long long lockedSize( void ) const;
+    /*! Touch every page of the buffer memory and of its mirror once,
+        so that it is mapped to physical memory in advance.
+	The content of the buffer is not changed. */
+  void prefault( void );
 
     /*! Returns a const reference to the data element at index \a i.
         No range checking is performed. */
@@ -145,16 +289,28 @@ class CyclicBuffer
         and return its value. */
   inline T pop( void );
     /*! Maximum number of data elements allowed to be added to the buffer 
-        at once. 
+        at once. Limited to the range of an int,
+	even if the capacity() of the buffer is larger.
         \sa pushBuffer(), push() */
   int maxPush( void ) const;
     /*! Pointer into the buffer where to add data.
-        \sa maxPush(), push() */
+        \sa claim(), maxPush(), push() */
   T *pushBuffer( void );
+    /*! Announce that the next \a n data elements (at most maxPush())
+        are going to be written into pushBuffer().
+	From now on minIndex() excludes the data elements that are
+	overwritten by them. Call this before writing the data.
+        \sa push() */
+  inline void claim( int n );
     /*! Tell CyclicBuffer that \a n data elements have been added to
-        pushBuffer().
+        pushBuffer() and publish them to the readers.
+	If \a visible is \c false, the data are not yet published,
+	so that several chunks can be made visible at once by publish().
         \sa maxPush() */
-  void push( int n );
+  void push( int n, bool visible=true );
+    /*! Make the current number of data elements visible to readers.
+        \sa push() */
+  inline void publish( void );
 
     /*! The number of data elements available to be read from the array. 
         \sa read(), readIndex(), size(), accessibleSize() */
@@ -178,13 +334,28 @@ class CyclicBuffer
     /*! The type used for sizes and indices. */
   typedef long long size_type;
 
+    /*! The one or two contiguous memory spans covering the data elements
+        from index \a from upto (excluding) index \a upto.
+        On return, \a data1 points to the first \a n1 data elements.
+        If the range wraps around the end of the buffer,
+        \a data2 points to the remaining \a n2 data elements
+        at the beginning of the buffer.
+        Otherwise \a data2 is set to the end of the first span and \a n2 to zero.
+        The pointers stay valid until the producer overwrites the data,
+        i.e. as long as \a from >= minIndex().
+        Assumes \a upto to be <= size().
+        \return the number of spans (0, 1, or 2), -3 if \a from > \a upto,
+	or -4 if the range exceeds capacity(). */
+  int spans( long long from, long long upto,
+	     const T *&data1, long long &n1, const T *&data2, long long &n2 ) const;
+
     /*! Save binary data to stream \a os starting at index \a index upto size().
         \return the number of saved data elements. */
-  int saveBinary( ostream &os, long long index ) const;
+  long long saveBinary( ostream &os, long long index ) const;
     /*! Save binary data to stream \a os starting at index \a from upto index \a upto.
         Assumes \a from and \a upto to be valid indices, i.e. <= size() and >= minIndex().
         \return the number of saved data elements. */
-  int saveBinary( ostream &os, long long from, long long upto ) const;
+  long long saveBinary( ostream &os, long long from, long long upto ) const;
 
   template < typename TT > 
   friend ostream &operator<<( ostream &str, const CyclicBuffer<TT> &ca );
@@ -193,13 +364,52 @@ class CyclicBuffer
   private:
 
   T *Buffer;
-  int NBuffer;
-  int RCycles;
-  int R;
-  int LCycles;
-  int L;
+  long long RCycles;
+  long long R;
+  long long LCycles;
+  long long L;
   T Val;  // for pop()
   mutable T Dummy;
+    /*! The buffer memory is mapped twice. */
+  bool Mirrored;
+    /*! How the buffer memory was obtained (see allocate()). */
+  int Memory;
+    /*! The requested way to obtain buffer memory (see allocate()). */
+  int Policy;
+    /*! The buffer memory is locked. */
+  bool Locked;
+    /*! The capacity is a multiple of this number of data elements. */
+  int Granularity;
+    /*! The number of bytes of buffer memory obtained from allocate(). */
+  size_t Allocated;
+
+    /*! Flags describing how buffer memory is obtained. */
+  enum MemoryFlags {
+    MappedMemory=1,
+    MirroredMemory=2,
+    TransparentMemory=4,
+    HugePagesMemory=8
+  };
+    /*! Allocate memory for at least \a n data elements
+        as requested by the MemoryFlags in \a policy.
+	On return, \a n is the capacity of the new buffer, a multiple
+	of \a granularity unless the memory is mirrored,
+	\a memory the MemoryFlags that actually apply,
+	and \a bytes the size of the obtained memory. */
+  static T *allocate( long long &n, int granularity, int policy,
+		      int &memory, size_t &bytes );
+    /*! Release the memory \a buffer of \a bytes bytes
+        that was obtained from allocate() with flags \a memory. */
+  static void deallocate( T *buffer, size_t bytes, int memory );
+    /*! Release the buffer memory and clear the buffer. */
+  void release( void );
+    /*! Publish the current number of data elements after
+        the structure of the buffer changed and withdraw any claim. */
+  void republish( void );
+#ifdef __linux__
+    /*! The size of a huge page in bytes as reported by /proc/meminfo. */
+  static size_t hugePageSize( void );
+#endif
   
 };
 
@@ -207,30 +417,40 @@ class CyclicBuffer
 template < class T >
 CyclicBuffer< T >::CyclicBuffer( void )
   : Buffer( 0 ),
-    NBuffer( 0 ),
     RCycles( 0 ),
     R( 0 ),
     LCycles( 0 ),
     L( 0 ),
     Val( 0 ),
-    Dummy( 0 )
+    Dummy( 0 ),
+    Mirrored( false ),
+    Memory( 0 ),
+    Policy( 0 ),
+    Locked( false ),
+    Granularity( 1 ),
+    Allocated( 0 )
 {
 }
 
 
 template < class T >
-CyclicBuffer< T >::CyclicBuffer( int n )
+CyclicBuffer< T >::CyclicBuffer( long long n )
   : Buffer( 0 ),
-    NBuffer( 0 ),
     RCycles( 0 ),
     R( 0 ),
     LCycles( 0 ),
     L( 0 ),
     Val( 0 ),
-    Dummy( 0 )
+    Dummy( 0 ),
+    Mirrored( false ),
+    Memory( 0 ),
+    Policy( 0 ),
+    Locked( false ),
+    Granularity( 1 ),
+    Allocated( 0 )
 {
   if ( n > 0 ) {
-    Buffer = new T[ n ];
+    Buffer = allocate( n, Granularity, Policy, Memory, Allocated );
     NBuffer = n;
   }
 }
@@ -239,27 +459,38 @@ CyclicBuffer< T >::CyclicBuffer( int n )
 template < class T >
 CyclicBuffer< T >::CyclicBuffer( const CyclicBuffer< T > &ca )
   : Buffer( 0 ),
-    NBuffer( 0 ),
     RCycles( ca.RCycles ),
     R( ca.R ),
     LCycles( ca.LCycles ),
     L( ca.L ),
     Val( ca.Val ),
-    Dummy( ca.Dummy )
+    Dummy( ca.Dummy ),
+    Mirrored( false ),
+    Memory( 0 ),
+    Policy( ca.Policy ),
+    Locked( false ),
+    Granularity( ca.Granularity ),
+    Allocated( 0 )
 {
   if ( ca.capacity() > 0 ) {
-    Buffer = new T[ ca.capacity() ];
-    NBuffer = ca.capacity();
-    memcpy( Buffer, ca.Buffer, NBuffer * sizeof( T ) );
+    long long n = ca.capacity();
+    Buffer = allocate( n, Granularity, Policy, Memory, Allocated );
+    Mirrored = ( Memory & MirroredMemory );
+    NBuffer = n;
+    memcpy( Buffer, ca.Buffer, ca.capacity() * sizeof( T ) );
   }
+  Size = ca.size();
+  Claimed = Size;
 }
 
 
 template < class T >
 CyclicBuffer< T >::~CyclicBuffer( void )
 {
-  if ( Buffer != 0 )
-    delete [] Buffer;
+  if ( Buffer != 0 ) {
+    unlock();
+    deallocate( Buffer, Allocated, Memory );
+  }
 }
 
 
@@ -276,17 +507,25 @@ const CyclicBuffer<T> &CyclicBuffer<T>::assign( const CyclicBuffer<T> &a )
   if ( &a == this )
     return *this;
 
-  if ( Buffer != 0 )
-    delete [] Buffer;
+  if ( Buffer != 0 ) {
+    unlock();
+    deallocate( Buffer, Allocated, Memory );
+  }
   Buffer = 0;
   NBuffer = 0;
   Val = 0;
+  Policy = a.Policy;
+  Granularity = a.Granularity;
+  Memory = 0;
+  Allocated = 0;
+  Mirrored = false;
 
   if ( a.capacity() > 0 ) {
-    Buffer = new T[ a.capacity() ];
-    NBuffer = a.capacity();
-    R = a.size();
-    memcpy( Buffer, a.Buffer, NBuffer * sizeof( T ) );
+    long long n = a.capacity();
+    Buffer = allocate( n, Granularity, Policy, Memory, Allocated );
+    Mirrored = ( Memory & MirroredMemory );
+    NBuffer = n;
+    memcpy( Buffer, a.Buffer, a.capacity() * sizeof( T ) );
     RCycles = a.RCycles;
     R = a.R;
     LCycles = a.LCycles;
@@ -298,43 +537,46 @@ const CyclicBuffer<T> &CyclicBuffer<T>::assign( const CyclicBuffer<T> &a )
     LCycles = 0;
     L = 0;
   }
+  republish();
 
   return *this;
 }
 
 
 template < class T >
-long long CyclicBuffer< T >::size( void ) const
+void CyclicBuffer< T >::publish( void )
 {
   long long n = RCycles;
   n *= NBuffer;
-  return n + R;
-}
-
-
-template < class T >
-int CyclicBuffer< T >::accessibleSize( void ) const
-{
-  return RCycles == 0 ? R : NBuffer;
+  n += R;
+  // data elements that were not claimed before they were written:
+  if ( Claimed < n )
+    __atomic_store_n( &Claimed, n, __ATOMIC_RELAXED );
+  __atomic_store_n( &Size, n, __ATOMIC_RELEASE );
 }
 
 
 template < class T >
-long long CyclicBuffer< T >::minIndex( void ) const
+void CyclicBuffer< T >::republish( void )
 {
-  if ( RCycles == 0 )
-    return 0;
-
-  long long n = RCycles-1;
+  long long n = RCycles;
   n *= NBuffer;
-  return n + R;
+  __atomic_store_n( &Claimed, n + R, __ATOMIC_RELAXED );
+  publish();
 }
 
 
 template < class T >
-bool CyclicBuffer< T >::empty( void ) const
+void CyclicBuffer< T >::claim( int n )
 {
-  return RCycles == 0 && R == 0;
+  long long e = RCycles;
+  e *= NBuffer;
+  e += R + n;
+  if ( e <= Claimed )
+    return;
+  __atomic_store_n( &Claimed, e, __ATOMIC_RELAXED );
+  // the claim becomes visible before any of the data written hereafter:
+  __atomic_thread_fence( __ATOMIC_RELEASE );
 }
 
 
@@ -348,12 +590,13 @@ void CyclicBuffer< T >::resize( long long n, const T &val )
 
   if ( NBuffer <= 0 ) {
     reserve( n );
-    for ( int k=0; k<NBuffer; k++ )
+    for ( long long k=0; k<NBuffer; k++ )
       Buffer[k] = val;
     RCycles = 0;
     R = n;
     LCycles = 0;
     L = 0;
+    republish();
     return;
   }
 
@@ -367,21 +610,21 @@ void CyclicBuffer< T >::resize( long long n, const T &val )
   }
   else if ( n > size() ) {
     if ( n - size() >= NBuffer ) {
-      for ( int k=0; k<NBuffer; k++ )
+      for ( long long k=0; k<NBuffer; k++ )
 	Buffer[k] = val;
       RCycles = (n-1) / NBuffer;
       R = 1 + (n-1) % NBuffer;
     }
     else {
-      int orc = RCycles;
-      int ori = R;
+      long long orc = RCycles;
+      long long ori = R;
       RCycles = (n-1) / NBuffer;
       R = 1 + (n-1) % NBuffer;
       if ( RCycles > orc ) {
-	for ( int k=ori; k<NBuffer; k++ )
+	for ( long long k=ori; k<NBuffer; k++ )
 	  Buffer[k] = val;
       }
-      for ( int k=0; k<R; k++ )
+      for ( long long k=0; k<R; k++ )
 	Buffer[k] = val;
     }
     if ( (LCycles+1)*NBuffer + L < RCycles*NBuffer + R ) {
@@ -389,6 +632,7 @@ void CyclicBuffer< T >::resize( long long n, const T &val )
       L = R;
     }
   }
+  republish();
 }
 
 
@@ -399,29 +643,30 @@ void CyclicBuffer< T >::clear( void )
   R = 0;
   LCycles = 0;
   L = 0;
+  republish();
 }
 
 
 template < class T >
-int CyclicBuffer< T >::capacity( void ) const
+void CyclicBuffer< T >::reserve( long long n, int granularity )
 {
-  return NBuffer;
-}
-
-
-template < class T >
-void CyclicBuffer< T >::reserve( int n )
-{
-  if ( n > NBuffer ) {
-    T *newbuf = new T[ n ];
+  if ( granularity < 1 )
+    granularity = 1;
+  Granularity = granularity;
+  if ( n > NBuffer || ( NBuffer % granularity != 0 && ! Mirrored ) ) {
+    if ( n < NBuffer )
+      n = NBuffer;
+    int memory = 0;
+    size_t allocated = 0;
+    T *newbuf = allocate( n, granularity, Policy, memory, allocated );
     if ( Buffer != 0 && NBuffer > 0 ) {
-      int ori = R;
+      long long ori = R;
       long long on = size();
       RCycles = (on-1) / n;
       R = 1 + (on-1) % n;
-      int j = ori;
-      int k = R;
-      for ( int i=0; i < NBuffer; i++ ) {
+      long long j = ori;
+      long long k = R;
+      for ( long long i=0; i < NBuffer; i++ ) {
 	if ( j == 0 )
 	  j = NBuffer;
 	if ( k == 0 )
@@ -430,17 +675,264 @@ void CyclicBuffer< T >::reserve( int n )
 	k--;
 	newbuf[k] = Buffer[j];
       }
-      delete [] Buffer;
-      int oln = LCycles*NBuffer + L;
+      bool locked = Locked;
+      unlock();
+      deallocate( Buffer, Allocated, Memory );
+      Locked = locked;
+      long long oln = LCycles*NBuffer + L;
       LCycles = (oln-1) / n;
       L = 1 + (oln-1) % n;
     }
     Buffer = newbuf;
     NBuffer = n;
+    Memory = memory;
+    Allocated = allocated;
+    Mirrored = ( Memory & MirroredMemory );
+    if ( Locked ) {
+      Locked = false;
+      lock();
+    }
+    republish();
   }
 }
 
 
+template < class T >
+void CyclicBuffer< T >::setMirrored( bool mirrored )
+{
+  int policy = mirrored ? Policy | MirroredMemory : Policy & ~MirroredMemory;
+  if ( policy == Policy )
+    return;
+  Policy = policy;
+  release();
+}
+
+
+template < class T >
+bool CyclicBuffer< T >::mirrored( void ) const
+{
+  return Mirrored;
+}
+
+
+template < class T >
+void CyclicBuffer< T >::setHugePages( int policy )
+{
+  int p = Policy & ~( TransparentMemory | HugePagesMemory );
+  if ( policy == TransparentHugePages )
+    p |= TransparentMemory;
+  else if ( policy == ExplicitHugePages )
+    p |= HugePagesMemory;
+  if ( p == Policy )
+    return;
+  Policy = p;
+  release();
+}
+
+
+template < class T >
+int CyclicBuffer< T >::hugePages( void ) const
+{
+  if ( Memory & HugePagesMemory )
+    return ExplicitHugePages;
+  else if ( Memory & TransparentMemory )
+    return TransparentHugePages;
+  else
+    return NoHugePages;
+}
+
+
+template < class T >
+int CyclicBuffer< T >::lock( void )
+{
+  if ( Locked )
+    return 0;
+  if ( Buffer == 0 || NBuffer <= 0 )
+    return 0;
+#ifdef __linux__
+  // the mirror maps the same pages, but its page table entries
+  // are only populated by locking it as well:
+  size_t bytes = NBuffer * sizeof( T );
+  if ( Mirrored )
+    bytes *= 2;
+  if ( mlock( Buffer, bytes ) != 0 )
+    return errno;
+  Locked = true;
+  return 0;
+#else
+  return ENOSYS;
+#endif
+}
+
+
+template < class T >
+void CyclicBuffer< T >::unlock( void )
+{
+#ifdef __linux__
+  if ( Locked )
+    munlock( Buffer, Mirrored ? 2 * NBuffer * sizeof( T ) : NBuffer * sizeof( T ) );
+#endif
+  Locked = false;
+}
+
+
+template < class T >
+long long CyclicBuffer< T >::lockedSize( void ) const
+{
+  long long n = Locked ? NBuffer : 0;
+  return n * sizeof( T );
+}
+
+
+template < class T >
+void CyclicBuffer< T >::prefault( void )
+{
+  if ( Buffer == 0 || NBuffer <= 0 )
+    return;
+#ifdef __linux__
+  size_t pagesize = sysconf( _SC_PAGESIZE );
+#else
+  size_t pagesize = 4096;
+#endif
+  // write each page once to get it mapped, without changing its content,
+  // the pages of the mirror need to be mapped separately:
+  volatile char *p = (volatile char *)Buffer;
+  size_t bytes = NBuffer * sizeof( T );
+  if ( Mirrored )
+    bytes *= 2;
+  for ( size_t k=0; k<bytes; k += pagesize )
+    p[k] = p[k];
+  p[bytes-1] = p[bytes-1];
+}
+
+
+template < class T >
+void CyclicBuffer< T >::release( void )
+{
+  if ( Buffer != 0 ) {
+    unlock();
+    deallocate( Buffer, Allocated, Memory );
+  }
+  Buffer = 0;
+  NBuffer = 0;
+  Memory = 0;
+  Allocated = 0;
+  Mirrored = false;
+  clear();
+}
+
+
+#ifdef __linux__
+template < class T >
+size_t CyclicBuffer< T >::hugePageSize( void )
+{
+  size_t size = 2*1024*1024;
+  FILE *mf = fopen( "/proc/meminfo", "r" );
+  if ( mf != 0 ) {
+    char line[256];
+    unsigned long kb = 0;
+    while ( fgets( line, sizeof( line ), mf ) != 0 ) {
+      if ( sscanf( line, "Hugepagesize: %lu kB", &kb ) == 1 ) {
+	size = kb*1024;
+	break;
+      }
+    }
+    fclose( mf );
+  }
+  return size;
+}
+#endif
+
+
+template < class T >
+T *CyclicBuffer< T >::allocate( long long &n, int granularity, int policy,
+				int &memory, size_t &bytes )
+{
+  memory = 0;
+  if ( granularity > 1 )
+    n = ( ( n + granularity - 1 ) / granularity ) * granularity;
+  bytes = n * sizeof( T );
+#ifdef __linux__
+  if ( policy != 0 ) {
+    // the size of the mapping has to be a multiple of the page size
+    // and of the size of a data element:
+    size_t pagesize = sysconf( _SC_PAGESIZE );
+    if ( policy & HugePagesMemory )
+      pagesize = hugePageSize();
+    bytes = ( ( n * sizeof( T ) + pagesize - 1 ) / pagesize ) * pagesize;
+    while ( bytes % sizeof( T ) != 0 )
+      bytes += pagesize;
+    char *addr = 0;
+    if ( policy & MirroredMemory ) {
+      int fd = memfd_create( "cyclicbuffer", MFD_CLOEXEC |
+			     ( ( policy & HugePagesMemory ) ? MFD_HUGETLB : 0 ) );
+      if ( fd >= 0 ) {
+	if ( ftruncate( fd, bytes ) == 0 ) {
+	  // reserve address space for both copies:
+	  void *a = mmap( 0, 2*bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	  if ( a != MAP_FAILED ) {
+	    addr = (char *)a;
+	    // map the same pages twice:
+	    if ( mmap( addr, bytes, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_FIXED, fd, 0 ) == MAP_FAILED ||
+		 mmap( addr + bytes, bytes, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_FIXED, fd, 0 ) == MAP_FAILED ) {
+	      munmap( addr, 2*bytes );
+	      addr = 0;
+	    }
+	  }
+	}
+	close( fd );
+      }
+      if ( addr != 0 )
+	memory = MappedMemory | MirroredMemory | ( policy & HugePagesMemory );
+    }
+    else {
+      void *a = mmap( 0, bytes, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS |
+		      ( ( policy & HugePagesMemory ) ? MAP_HUGETLB : 0 ), -1, 0 );
+      if ( a != MAP_FAILED ) {
+	addr = (char *)a;
+	memory = MappedMemory | ( policy & HugePagesMemory );
+      }
+    }
+    if ( addr == 0 && ( policy & HugePagesMemory ) ) {
+      // no explicit huge pages available, retry with normal pages:
+      return allocate( n, granularity, policy & ~HugePagesMemory, memory, bytes );
+    }
+    if ( addr != 0 ) {
+      if ( ( policy & TransparentMemory ) && ( memory & HugePagesMemory ) == 0 &&
+	   madvise( addr, bytes, MADV_HUGEPAGE ) == 0 )
+	memory |= TransparentMemory;
+      n = bytes / sizeof( T );
+      // without mirroring maxPush() is truncated at the end of the buffer,
+      // so keep the capacity a multiple of the granularity
+      // and leave the rest of the last page unused:
+      if ( ( memory & MirroredMemory ) == 0 && granularity > 1 )
+	n -= n % granularity;
+      if ( memory & MirroredMemory )
+	bytes *= 2;
+      return (T *)addr;
+    }
+  }
+#endif
+  return new T[ n ];
+}
+
+
+template < class T >
+void CyclicBuffer< T >::deallocate( T *buffer, size_t bytes, int memory )
+{
+#ifdef __linux__
+  if ( memory & MappedMemory ) {
+    munmap( buffer, bytes );
+    return;
+  }
+#endif
+  delete [] buffer;
+}
+
+
 template < class T >
 const T &CyclicBuffer< T >::operator[]( long long i ) const
 {
@@ -512,8 +1004,9 @@ T &CyclicBuffer<T>::front( void )
 template < typename T > 
 const T &CyclicBuffer<T>::back( void ) const
 {
-  if ( Buffer != 0 && size() > 0 ) {
-    return Buffer[R-1];
+  long long n = size();
+  if ( Buffer != 0 && n > 0 ) {
+    return Buffer[(n-1) % NBuffer];
   }
   else {
     Dummy = 0;
@@ -525,8 +1018,9 @@ const T &CyclicBuffer<T>::back( void ) const
 template < typename T > 
 T &CyclicBuffer<T>::back( void )
 {
-  if ( Buffer != 0 && size() > 0 ) {
-    return Buffer[R-1];
+  long long n = size();
+  if ( Buffer != 0 && n > 0 ) {
+    return Buffer[(n-1) % NBuffer];
   }
   else {
     Dummy = 0;
@@ -547,10 +1041,12 @@ void CyclicBuffer< T >::push( const T &val )
     RCycles++;
   }
 
+  claim( 1 );
   Val = Buffer[ R ];
   Buffer[ R ] = val;
 
   R++;
+  publish();
 }
 
 
@@ -569,6 +1065,7 @@ T CyclicBuffer< T >::pop( void )
     R = NBuffer;
     RCycles--;
   }
+  publish();
 
   return v;
 }
@@ -577,7 +1074,10 @@ T CyclicBuffer< T >::pop( void )
 template < class T >
 int CyclicBuffer< T >::maxPush( void ) const
 {
-  return R < NBuffer ? NBuffer - R : NBuffer;
+  long long n = NBuffer;
+  if ( ! Mirrored && R < NBuffer )
+    n = NBuffer - R;
+  return n > INT_MAX ? INT_MAX : (int)n;
 }
 
 
@@ -589,7 +1089,7 @@ T *CyclicBuffer< T >::pushBuffer( void )
 
 
 template < class T >
-void CyclicBuffer< T >::push( int n )
+void CyclicBuffer< T >::push( int n, bool visible )
 {
   if ( R >= NBuffer ) {
     R = 0;
@@ -597,19 +1097,26 @@ void CyclicBuffer< T >::push( int n )
   }
 
   R += n;
+  if ( Mirrored && R > NBuffer ) {
+    // data have been written into the mirrored pages:
+    R -= NBuffer;
+    RCycles++;
+  }
 
 #ifndef NDEBUG
   if ( !( R >= 0 && R <= NBuffer ) )
     cerr << "CyclicBuffer::push( int n ): R=" << R << " <0 or > NBuffer=" << NBuffer << endl; 
 #endif
   assert( ( R >= 0 && R <= NBuffer ) );
+  if ( visible )
+    publish();
 }
 
 
 template < class T >
 long long CyclicBuffer< T >::readSize( void ) const
 { 
-  long long n = (RCycles - LCycles)*NBuffer + R - L;
+  long long n = size() - readIndex();
 #ifndef NDEBUG
   if ( n > NBuffer )
     cerr << "overflow in CyclicBuffer!\n";
@@ -622,7 +1129,9 @@ long long CyclicBuffer< T >::readSize( void ) const
 template < class T >
 long long CyclicBuffer< T >::readIndex( void ) const
 {
-  return LCycles*NBuffer + L;
+  long long n = LCycles;
+  n *= NBuffer;
+  return n + L;
 }
 
 
@@ -632,7 +1141,7 @@ T CyclicBuffer< T >::read( void )
   if ( NBuffer <= 0 )
     return 0.0;
 
-  int l = L++;
+  long long l = L++;
   if ( L >= NBuffer ) {
     L = 0;
     LCycles++;
@@ -643,36 +1152,57 @@ T CyclicBuffer< T >::read( void )
 
 
 template < class T >
-int CyclicBuffer< T >::saveBinary( ostream &os, long long index ) const
+int CyclicBuffer< T >::spans( long long from, long long upto,
+			      const T *&data1, long long &n1, const T *&data2, long long &n2 ) const
+{
+  data1 = Buffer;
+  n1 = 0;
+  data2 = Buffer;
+  n2 = 0;
+
+  if ( from > upto )
+    return -3;
+  if ( from == upto )
+    return 0;
+  if ( upto - from > NBuffer )
+    return -4;
+
+  long long fi = from % NBuffer;
+  long long n = upto - from;
+  data1 = Buffer + fi;
+  if ( Mirrored || fi + n <= NBuffer ) {
+    n1 = n;
+    data2 = data1 + n1;
+    return 1;
+  }
+  else {
+    n1 = NBuffer - fi;
+    n2 = n - n1;
+    return 2;
+  }
+}
+
+
+template < class T >
+long long CyclicBuffer< T >::saveBinary( ostream &os, long long index ) const
 {
   // stream not open:
   if ( !os )
     return -1;
 
   // nothing to be saved:
-  if ( index >= size() )
+  long long n = size();
+  if ( index >= n )
     return -1;
 
   assert( index >= minIndex() );
 
-  long long buffinx = RCycles * NBuffer;
-  long long li = index - buffinx;
-  int ri = R;
-
-  // write buffer:
-  if ( li >= 0 )
-    os.write( (char *)(Buffer+li), sizeof( T )*( ri - li ) );
-  else {
-    os.write( (char *)(Buffer + (li+NBuffer)), sizeof( T )*( -li ) );
-    os.write( (char *)Buffer, sizeof( T )*ri );
-  }
-  os.flush();
-  return ri - li;
+  return saveBinary( os, index, n );
 }
 
 
 template < class T >
-int CyclicBuffer< T >::saveBinary( ostream &os, long long from, long long upto ) const
+long long CyclicBuffer< T >::saveBinary( ostream &os, long long from, long long upto ) const
 {
   // stream not open:
   if ( !os )
@@ -684,24 +1214,18 @@ int CyclicBuffer< T >::saveBinary( ostream &os, long long from, long long upto )
   if ( from > upto )
     return -3;
 
-  int fi = from % NBuffer;
-  int ui = upto % NBuffer;
+  const T *d1, *d2;
+  long long n1, n2;
+  int ns = spans( from, upto, d1, n1, d2, n2 );
+  if ( ns < 0 )
+    return ns;
 
   // write buffer:
-  if ( fi < ui ) {
-    os.write( (char *)(Buffer+fi), sizeof( T )*( ui - fi ) );
-    os.flush();
-    return ui - fi;
-  }
-  else {
-    if ( ui + NBuffer <=  fi )
-      return -4;
-    os.write( (char *)(Buffer+fi), sizeof( T )*( NBuffer-fi ) );
-    os.write( (char *)Buffer, sizeof( T )*ui );
-    os.flush();
-    return ui + NBuffer - fi;
-  }
-  return 0;
+  os.write( (const char *)d1, sizeof( T )*n1 );
+  if ( n2 > 0 )
+    os.write( (const char *)d2, sizeof( T )*n2 );
+  os.flush();
+  return n1 + n2;
 }
 
 
@@ -714,6 +1238,7 @@ ostream &operator<<( ostream &str, const CyclicBuffer< T > &ca )
   str << "R: " << ca.R << '\n';
   str << "LCycles: " << ca.LCycles << '\n';
   str << "L: " << ca.L << '\n';
+  str << "Size: " << ca.size() << '\n';
   str << "Val: " << ca.Val << '\n';
   return str;
 }
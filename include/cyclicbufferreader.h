@@ -0,0 +1,280 @@
+/*
+  cyclicbufferreader.h
+  An independent read cursor into a CyclicBuffer.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CYCLICBUFFERREADER_H_
+#define _CYCLICBUFFERREADER_H_ 1
+
+#include "cyclicbuffer.h"
+using namespace std;
+
+
+/*!
+\class CyclicBufferReader
+\brief An independent read cursor into a CyclicBuffer.
+\author Jan Benda
+
+Each consumer of the data of a CyclicBuffer (saving to disk, analysis,
+network streaming, audio monitor, ...) attaches its own
+CyclicBufferReader to the buffer. The reader only holds the index of
+the next data element to be read and does not modify the buffer.
+Therefore, any number of readers can follow a single producer
+without any locking. Since the reader only deals with indices,
+it works on CyclicBufferBase and thus on buffers of any data type.
+
+If the producer adds more data than the capacity() of the buffer
+before a reader got to read them, the reader has been lapped by the
+producer and the oldest unread data are lost. This already applies
+to the data elements the producer has claimed for writing, see
+CyclicBufferBase::minIndex(). overrun() indicates this situation,
+and recover() moves the reader to the oldest accessible data element
+and counts the number of lost data elements.
+
+The producer may overwrite data while a reader copies them out of the
+buffer. Therefore, the copied data need to be checked by validate()
+before they are used. A typical read loop looks like this:
+\code
+long long lost = reader.recover( channels );
+if ( lost > 0 )
+  cerr << "lost " << lost << " data elements\n";
+long long from = reader.readIndex();
+long long upto = from + reader.readSize();
+const float *d1, *d2;
+long long n1, n2;
+buffer.spans( from, upto, d1, n1, d2, n2 );
+memcpy( data, d1, n1*sizeof( float ) );
+memcpy( data+n1, d2, n2*sizeof( float ) );
+long long skip = reader.validate( from, upto, channels );
+process( data+skip, upto-from-skip );
+reader.read( upto-from );
+\endcode
+*/
+
+class CyclicBufferReader
+{
+
+  public:
+
+    /*! Creates a reader that is not attached to any CyclicBuffer. */
+  CyclicBufferReader( void );
+    /*! Creates a reader for \a buffer that starts reading at
+        the current size() of \a buffer. */
+  CyclicBufferReader( const CyclicBufferBase &buffer );
+
+    /*! Attach the reader to \a buffer. The next data element to be read
+        is \a index. If \a index is negative the reader starts
+        at the current size() of the buffer.
+        The number of lost data elements is reset to zero. */
+  void attach( const CyclicBufferBase &buffer, long long index=-1 );
+    /*! Detach the reader from its buffer. */
+  void detach( void );
+    /*! \c true if the reader is attached to a CyclicBuffer. */
+  bool attached( void ) const;
+    /*! The CyclicBuffer the reader is attached to. */
+  const CyclicBufferBase &buffer( void ) const;
+
+    /*! The index of the next data element to be read.
+        \sa readSize(), read(), seek() */
+  long long readIndex( void ) const;
+    /*! The number of data elements that are available for reading,
+        i.e. the number of accessible data elements starting from
+        the maximum of readIndex() and minIndex() of the buffer.
+        \sa lag(), overrun() */
+  long long readSize( void ) const;
+    /*! The number of data elements the reader is behind the producer,
+        i.e. the difference between the buffer's size() and readIndex().
+        If this is larger than the capacity() of the buffer,
+        then the reader has been lapped by the producer.
+        \sa readSize(), overrun() */
+  long long lag( void ) const;
+    /*! \c true if the producer has overwritten or is overwriting data
+        that have not been read yet by this reader.
+        \sa recover(), lost() */
+  bool overrun( void ) const;
+    /*! The total number of data elements that were lost
+        because the reader has been lapped by the producer.
+        This number is updated by recover().
+        \sa overrun() */
+  long long lost( void ) const;
+    /*! In case of an overrun() move the read index forward to
+        the oldest accessible data element. The number of skipped data
+        elements is a multiple of \a blocksize (e.g. the number of
+        channels multiplexed into the buffer), so that the readIndex()
+        stays aligned to the blocks.
+        \return the number of data elements that have been skipped
+	and that are added to lost(). */
+  long long recover( int blocksize=1 );
+    /*! Check whether the data elements from index \a from upto
+        index \a upto, which have just been copied out of the buffer,
+	have been overwritten by the producer in the meantime.
+	Call this after copying the data and before using them.
+	The number of invalid data elements at the beginning of the range
+	is a multiple of \a blocksize and is added to lost().
+	The read index is not changed.
+        \return the number of invalid data elements at the beginning
+	of the range, zero if all of them are valid. */
+  long long validate( long long from, long long upto, int blocksize=1 );
+
+    /*! Mark the next \a n data elements as read,
+        i.e. increment the read index by \a n. */
+  void read( long long n );
+    /*! Set the index of the next data element to be read to \a index.
+        Skipped data are not counted as lost. */
+  void seek( long long index );
+
+
+  private:
+
+  const CyclicBufferBase *Buffer;
+  long long Index;
+  long long Lost;
+
+};
+
+
+inline CyclicBufferReader::CyclicBufferReader( void )
+  : Buffer( 0 ),
+    Index( 0 ),
+    Lost( 0 )
+{
+}
+
+
+inline CyclicBufferReader::CyclicBufferReader( const CyclicBufferBase &buffer )
+  : Buffer( &buffer ),
+    Index( buffer.size() ),
+    Lost( 0 )
+{
+}
+
+
+inline void CyclicBufferReader::attach( const CyclicBufferBase &buffer, long long index )
+{
+  Buffer = &buffer;
+  Index = index >= 0 ? index : buffer.size();
+  Lost = 0;
+}
+
+
+inline void CyclicBufferReader::detach( void )
+{
+  Buffer = 0;
+  Index = 0;
+}
+
+
+inline bool CyclicBufferReader::attached( void ) const
+{
+  return ( Buffer != 0 );
+}
+
+
+inline const CyclicBufferBase &CyclicBufferReader::buffer( void ) const
+{
+  assert( Buffer != 0 );
+  return *Buffer;
+}
+
+
+inline long long CyclicBufferReader::readIndex( void ) const
+{
+  return Index;
+}
+
+
+inline long long CyclicBufferReader::readSize( void ) const
+{
+  if ( Buffer == 0 )
+    return 0;
+  long long inx = Buffer->minIndex();
+  long long n = Buffer->size();
+  if ( inx < Index )
+    inx = Index;
+  return n > inx ? n - inx : 0;
+}
+
+
+inline long long CyclicBufferReader::lag( void ) const
+{
+  if ( Buffer == 0 )
+    return 0;
+  return Buffer->size() - Index;
+}
+
+
+inline bool CyclicBufferReader::overrun( void ) const
+{
+  if ( Buffer == 0 )
+    return false;
+  return ( Index < Buffer->minIndex() );
+}
+
+
+inline long long CyclicBufferReader::lost( void ) const
+{
+  return Lost;
+}
+
+
+inline long long CyclicBufferReader::recover( int blocksize )
+{
+  if ( Buffer == 0 )
+    return 0;
+  long long skip = Buffer->minIndex() - Index;
+  if ( skip <= 0 )
+    return 0;
+  if ( blocksize > 1 )
+    skip = ( ( skip + blocksize - 1 ) / blocksize ) * blocksize;
+  Index += skip;
+  Lost += skip;
+  return skip;
+}
+
+
+inline long long CyclicBufferReader::validate( long long from, long long upto,
+						int blocksize )
+{
+  if ( Buffer == 0 || from >= upto )
+    return 0;
+  long long skip = Buffer->validIndex() - from;
+  if ( skip <= 0 )
+    return 0;
+  if ( blocksize > 1 )
+    skip = ( ( skip + blocksize - 1 ) / blocksize ) * blocksize;
+  if ( skip > upto - from )
+    skip = upto - from;
+  Lost += skip;
+  return skip;
+}
+
+
+inline void CyclicBufferReader::read( long long n )
+{
+  Index += n;
+}
+
+
+inline void CyclicBufferReader::seek( long long index )
+{
+  Index = index;
+}
+
+
+#endif /* ! _CYCLICBUFFERREADER_H_ */
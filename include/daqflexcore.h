@@ -118,7 +118,7 @@ public:
 
   DAQFlexCore( void );
   DAQFlexCore( const string &device );
-  ~DAQFlexCore( void );
+  virtual ~DAQFlexCore( void );
 
   virtual int open( const string &device, int mccdevicenum=1, const string &firmwarepath="" );
   virtual bool isOpen( void ) const;
@@ -134,6 +134,13 @@ public:
         \return error code  */
   int sendCommands( const string &command1, const string &command2 );
 
+    /*! \return the product ID of the \a mccdevicenum-th MCC device
+        connected to the USB bus without opening the device,
+	or 0 if there is no such device. */
+  static int productID( int mccdevicenum );
+    /*! \return the resolution of the A/D converter
+        of the product \a productid. */
+  static unsigned int maxAIData( int productid );
     /*! \return the resolution of the A/D converter. */
   unsigned int maxAIData( void ) const;
     /*! \return the maximum scan rate of the A/D converter. */
@@ -186,6 +193,16 @@ public:
   DAQFlexError writeBulkTransfer( unsigned char *data, int length, int *transferred,
 				  unsigned int timeout );
 
+    /*! A handle to the USB device, e.g. for asynchronous transfers. */
+  libusb_device_handle *deviceHandle( void );
+    /*! The endpoint for reading data. */
+  unsigned char endpointIn( void );
+    /*! The endpoint for writing data. */
+  unsigned char endpointOut( void );
+
+    /*! Convert the \a libusberror to an \a DAQFlexError. */
+  static DAQFlexError getLibUSBError( int libusberror );
+
     /*! Clear the reading endpoint. */
   void clearRead( void );
     /*! Clear the writing endpoint. */
@@ -232,13 +249,6 @@ public:
 
  private:
 
-    /*! A handle to the USB device. */
-  libusb_device_handle *deviceHandle( void );
-    /*! The endpoint for reading data. */
-  unsigned char endpointIn( void );
-    /*! The endpoint for writing data. */
-  unsigned char endpointOut( void );
-
   string productName( int productid );
   void setLibUSBError( int libusberror );
     /*! Send a message to the device. */
@@ -255,9 +265,6 @@ public:
   int uploadFPGAFirmware( const string &path, const string &filename );
   int transferFPGAfile( const string &path );
 
-    /*! Convert the \a libusberror to an \a DAQFlexError. */
-  static DAQFlexError getLibUSBError( int libusberror );
-
   libusb_device_handle *DeviceHandle;
   unsigned char EndpointIn;
   unsigned char EndpointOut;
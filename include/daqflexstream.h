@@ -0,0 +1,155 @@
+/*
+  daqflexstream.h
+  Asynchronous streaming of analog input data from a DAQFlex device.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DAQFLEXSTREAM_H_
+#define _DAQFLEXSTREAM_H_ 1
+
+#include <vector>
+#include <climits>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <libusb-1.0/libusb.h>
+#include "daqflexcore.h"
+#include "cyclicbuffer.h"
+#include "acquisitionstats.h"
+
+using namespace std;
+using namespace daqflex;
+
+
+/*!
+\class DAQFlexStream
+\brief Asynchronous streaming of analog input data from a DAQFlex device.
+\author Jan Benda
+
+startStream() submits several asynchronous libusb bulk transfers
+on the input endpoint of a DAQFlexCore device, so that the device
+always finds a transfer to put its data into. The transfers are handled
+by a dedicated thread running libusb's event loop. Each completed
+transfer is copied into a CyclicBuffer of raw 16 bit samples
+and immediately resubmitted from the completion callback.
+
+The acquisition thread follows the buffer() with a
+CyclicBufferReader and waits for new data by waitForData().
+
+Overruns of the device show up in the bulk stream itself as a stalled
+endpoint or an overflowing transfer, see error(). In addition the event
+thread queries the scan status of the device every statusInterval()
+and right after a transfer returned less data than requested,
+see overrun(). The control transfers of these checks thus never
+delay the acquisition thread. statusChecks() and statusTime()
+tell how often the check ran and what it cost.
+The analog input scan has to be started on the device
+after startStream() and stopped before stopStream().
+*/
+
+class DAQFlexStream : public QThread
+{
+
+public:
+
+    /*! Constructs an idle stream. */
+  DAQFlexStream( void );
+    /*! Stops the stream. */
+  ~DAQFlexStream( void );
+
+    /*! Allocate a buffer of at least \a buffersize samples
+        and submit \a transfers transfers of \a transfersize bytes each
+        on \a device, and start the event thread.
+        \a transfersize is rounded up to a multiple of the packet size
+	of the device.
+        \return 0 on success, or a DAQFlexCore::DAQFlexError. */
+  int startStream( DAQFlexCore *device, int transfers, int transfersize,
+		   long long buffersize );
+    /*! Cancel all transfers and stop the event thread. */
+  void stopStream( void );
+    /*! \c true if the transfers are running. */
+  bool streaming( void ) const;
+
+    /*! Query the scan status of the device every \a interval
+        microseconds. Zero disables the periodic check. */
+  void setStatusInterval( long long interval );
+    /*! The interval in microseconds between checks of the scan status. */
+  long long statusInterval( void ) const;
+
+    /*! The buffer the samples are written into. */
+  const CyclicBuffer< unsigned short > &buffer( void ) const;
+    /*! Wait until the buffer holds more than \a index samples,
+        a transfer failed, an overrun was reported,
+	or \a time milliseconds passed.
+	\return \c true if data beyond \a index are available. */
+  bool waitForData( long long index, unsigned long time=ULONG_MAX );
+
+    /*! The error of the first failed transfer, DAQFlexCore::Success if none. */
+  DAQFlexCore::DAQFlexError error( void ) const;
+    /*! The number of completed transfers. */
+  long long transfers( void ) const;
+    /*! The number of transfers that were shorter than requested. */
+  long long shortTransfers( void ) const;
+    /*! \c true if a check of the scan status reported an overrun. */
+  bool overrun( void ) const;
+    /*! The number of checks of the scan status. */
+  long long statusChecks( void ) const;
+    /*! The total time in microseconds spent in checks of the scan status. */
+  long long statusTime( void ) const;
+
+
+protected:
+
+    /*! The event loop handling the completed transfers. */
+  virtual void run( void );
+
+
+private:
+
+    /*! Completion callback of libusb, calls transferred(). */
+  static void LIBUSB_CALL callback( libusb_transfer *transfer );
+    /*! Copy the data of a completed \a transfer into the buffer
+        and resubmit it. */
+  void transferred( libusb_transfer *transfer );
+    /*! Query the scan status of the device. */
+  void checkStatus( void );
+    /*! Free all transfers. */
+  void freeTransfers( void );
+
+  DAQFlexCore *Device;
+  vector< libusb_transfer* > Transfers;
+  vector< unsigned char > TransferData;
+  CyclicBuffer< unsigned short > Buffer;
+  int Pending;
+  bool Stop;
+  DAQFlexCore::DAQFlexError Error;
+  long long Completed;
+  long long Short;
+  bool Overrun;
+  long long StatusInterval;
+  bool CheckStatus;
+  long long StatusChecks;
+  long long StatusTime;
+  mutable QMutex Mutex;
+  QWaitCondition DataCondition;
+
+};
+
+
+#endif /* ! _DAQFLEXSTREAM_H_ */
+
@@ -22,16 +22,42 @@
 #ifndef _DAQFLEXTHREAD_H_
 #define _DAQFLEXTHREAD_H_ 1
 
+#include <vector>
 #include "daqflexcore.h"
+#include "daqflexstream.h"
+#include "cyclicbufferreader.h"
+#include "converter.h"
+#include "demuxplan.h"
 #include "datathread.h"
 
 using namespace std;
+using namespace daqflex;
 
 
 /*! 
 \class DAQFlexThread
 \brief DataThread implementation for acquisition of data using DAQFlex
 \author Jan Benda
+
+The data of the DAQFlex USB devices are streamed by a DAQFlexStream
+per device into a buffer of raw samples. read() waits for the data,
+converts them in whole scans to voltages, and routes them via a DemuxPlan
+to the input buffers of the grids.
+
+Several devices are started together according to the "sync" option:
+"clock" paces all devices by the A/D clock of the first device
+(its AICKO output wired to the AICKI inputs of the others),
+"trigger" starts all devices on a rising edge on their TRIG inputs,
+and "none" just starts them one after the other.
+read() always takes the same number of whole scans from each device,
+so the streams are aligned by sample count. The difference between
+the scans available from the devices is added to the statistics as skew.
+It includes the granularity of the transfers; with independent clocks
+it grows with the drift between the devices.
+
+Overruns are detected from the bulk stream itself. The scan status
+of the devices is queried only every "statusinterval" seconds
+by the event threads of the streams, off the path of read().
 */
 
 class DAQFlexThread : public DataThread
@@ -40,10 +66,12 @@ class DAQFlexThread : public DataThread
 public:
 
   DAQFlexThread( ConfigData *cd );
+  ~DAQFlexThread( void );
 
 
 protected:
 
+  virtual bool rawInputSupported( void );
   virtual int initialize( double duration=0.0 );
   virtual void finish( void );
   virtual int read( void );
@@ -51,33 +79,50 @@ protected:
 
 private:
 
+    /*! Transfer \a scans whole scans of device \a j starting
+        \a from scans after the current read index of its reader
+	to the input buffers \a fp or \a rp. */
+  void transferScans( int j, int from, int scans, float **fp, RawSample **rp );
+    /*! Add the checks of the scan status since the last call to the statistics. */
+  void countStatusChecks( void );
+
     /*! Number of daqflex devices in use. */
   int NDevices;
     /*! Maximum number of daqflex devices supportet. */
   static const int MaxDevices = 4;
-    /*! The daqflex device number. */
-  unsigned int SubDevice[MaxDevices];
+    /*! The daqflex devices. */
+  DAQFlexCore *Devices[MaxDevices];
+    /*! The streams of data from each device. */
+  DAQFlexStream Streams[MaxDevices];
+    /*! The readers of the data of each stream. */
+  CyclicBufferReader Readers[MaxDevices];
     /*! The number of channels that are sampled from each device. */
   int NChannels[MaxDevices];
     /*! The number of samples that are to be sampled from each device. */
-  int MaxSamples[MaxDevices];
+  long long MaxSamples[MaxDevices];
     /*! The number of samples that are already sampled from each device. */
-  int Samples[MaxDevices];
+  long long Samples[MaxDevices];
     /*! The grid index for each channel. */
   int GridChannel[MaxDevices][100];
-    /*! Size of the internal buffers used for getting the data from the driver (in bytes). */
-  int BufferSize[MaxDevices];
-    /*! Number of bytes in the internal buffers used for getting the data from the driver. */
-  int NBuffer[MaxDevices];
-    /*! The internal buffers used for getting the data from the driver. */
-  char *Buffer[MaxDevices];
-    /*! Index of current device for writing data into the buffer. */
-  int DeviceInx;
-    /*! Index of current channel of current device for writing data into the buffer. */
-  int ChannelInx;
+    /*! Conversion of the raw counts of each device into voltages. */
+  Converter Converters[MaxDevices];
+    /*! The data of a device converted into voltages. */
+  vector< float > Converted[MaxDevices];
+    /*! The routing of the channels of all devices to the grids. */
+  DemuxPlan Plan;
+    /*! The number of checks of the scan status of each device
+        already added to the statistics. */
+  long long StatusChecks[MaxDevices];
+    /*! The time of the checks of the scan status of each device
+        already added to the statistics. */
+  long long StatusTime[MaxDevices];
+    /*! How the devices are synchronized: 0 by the clock of the first device,
+        1 by an external trigger, 2 not at all, -1 not initialized. */
+  int Sync;
+    /*! The maximum time in milliseconds read() waits for data. */
+  unsigned long WaitTime;
 
 };
 
 
 #endif /* ! _DAQFLEXTHREAD_H_ */
-
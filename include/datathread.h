@@ -22,11 +22,20 @@
 #ifndef _DATATHREAD_H_
 #define _DATATHREAD_H_ 1
 
+#include <vector>
+#include <climits>
+#include <cstring>
 #include <QThread>
 #include <QMutex>
+#include <QWaitCondition>
+#include <QSemaphore>
 #include <relacs/configclass.h>
 #include "cyclicbuffer.h"
+#include "cyclicbufferreader.h"
 #include "configdata.h"
+#include "acquisitionstats.h"
+#include "converter.h"
+#include "demuxplan.h"
 
 using namespace std;
 using namespace relacs;
@@ -36,10 +45,60 @@ using namespace relacs;
 \class DataThread
 \brief Base class for acquiring data
 \author Jan Benda
+
+The acquired data of each grid are stored either as floats in
+inputBuffer() or, if the "rawbuffer" option is set and the
+implementation supports it, as raw 16-bit ADC counts in rawInputBuffer()
+together with a calibration polynomial for each channel.
+In both cases inputRing() provides sizes and indices and
+convert() returns the data as floats.
+
+By default the data in the buffers are interleaved, i.e. the data of
+all channels of one sample are followed by the data of the next
+sample. If the "blocksamples" option is set to a number of samples
+\a B larger than zero, the buffers are organized in blocks of
+blockSize() = \a B times gridChannels() data elements. Within a block
+the \a B samples of the first channel are followed by the \a B
+samples of the second channel, and so on. Blocks are published as a
+whole, so the size of the buffers is always a multiple of blockSize().
+
+Implementations of read() add data via maxPush(), pushBuffer()
+or rawPushBuffer(), and push(). The push buffers point directly into
+the input buffers, so the implementations write the data in the layout
+of the buffers, using scanStride() and channelStride(), or via the
+DemuxPlan passed to setBoards().
+Implementations acquiring all grids at once use claimScans() and
+pushScans() instead. The data elements handed out by pushBuffer()
+are claimed in the input buffer before they are written, so that
+consumers never take them for valid data.
+
+Consumers do not need to poll the buffers. Whenever "notifyscans"
+new scans (or, if this is zero, the scans of "notifytime" seconds)
+have been published, the acquisition thread wakes up all threads
+blocked in waitForData() and emits the dataAvailable() signal.
+Both also happen when the acquisition thread terminates.
+
+The performance of the data acquisition is monitored by an
+AcquisitionStats, see stats(). Every "statsinterval" seconds
+a summary is written to the log.
+
+The acquisition thread can be run with real-time scheduling
+("scheduler" fifo or rr with "priority"), pinned to the CPUs listed
+in "cpu" (e.g. "2,3" or "2-3"), and all memory of the process can be
+locked into RAM ("lockmemory"). start() applies these requests and
+logs a warning if one of them is denied, e.g. because of missing
+privileges or resource limits. The policy the thread actually got
+is reported by schedulingOptions().
+
+After each call of read() that published new scans, the number of
+scans published so far is stamped with the monotonic and the
+real-time clock of the system, see clockStamps(). This maps sample
+indices to the times at which the data actually arrived.
 */
 
 class DataThread : public QThread, public ConfigClass
 {
+  Q_OBJECT
 
 public:
 
@@ -47,6 +106,11 @@ public:
   int start( double duration=0.0 );
   void stop( void );
   bool running( void ) const;
+    /*! \c true if the last run of the acquisition ended because
+        read() delivered all data, e.g. at the end of a replayed recording,
+	and not because it was stopped or failed.
+	Then the acquisition should not be restarted. */
+  bool endOfData( void ) const;
 
     /*! \return the maximum number of grids. */
   int maxGrids( void ) const;
@@ -71,7 +135,44 @@ public:
   inline CyclicBuffer< float > &inputBuffer( int g ) { return AIBuffer[g]; };
     /*! The analog input buffer. */
   inline const CyclicBuffer< float > &inputBuffer( int g ) const { return AIBuffer[g]; };
-    /*! Lock the analog input mutex for grid \a g. */
+
+    /*! The type of the raw ADC counts. */
+  typedef unsigned short RawSample;
+    /*! \c true if the data are stored as raw ADC counts
+        in rawInputBuffer() instead of inputBuffer(). */
+  bool rawInput( void ) const;
+    /*! The analog input buffer holding raw ADC counts. */
+  inline CyclicBuffer< RawSample > &rawInputBuffer( int g ) { return AIRawBuffer[g]; };
+    /*! The analog input buffer holding raw ADC counts. */
+  inline const CyclicBuffer< RawSample > &rawInputBuffer( int g ) const { return AIRawBuffer[g]; };
+    /*! The analog input buffer of grid \a g that is actually used,
+        either inputBuffer() or rawInputBuffer().
+	Use this for sizes and indices of the acquired data. */
+  const CyclicBufferBase &inputRing( int g ) const;
+    /*! Write the data elements of grid \a g from index \a from
+        upto index \a upto as floats into \a data.
+	Raw ADC counts are converted by the calibration polynomials.
+	\a data must provide space for \a upto - \a from floats.
+	\return the number of converted data elements,
+	a negative number as returned by CyclicBuffer::spans(),
+	or -5 if some of the data elements have been overwritten
+	while they were converted. */
+  long long convert( int g, long long from, long long upto, float *data ) const;
+    /*! The number of samples per channel in a block of the input buffers.
+        Zero if the data are interleaved.
+	\sa blockSize() */
+  int blockSamples( void ) const;
+    /*! The number of data elements in a block of the input buffer of grid \a g,
+        i.e. blockSamples() times gridChannels(),
+	or gridChannels() if the data are interleaved.
+	\sa blockSamples() */
+  int blockSize( int g ) const;
+
+    /*! Lock the analog input mutex for grid \a g.
+        Adding data to and reading data from the input buffer
+        does not need to be protected by this mutex.
+	Only changes to the structure of the input buffer
+	(reserve(), resize(), clear()) need to be locked. */
   void lockAI( int g );
     /*! Unlock the analog input mutex for grid \a g. */
   void unlockAI( int g );
@@ -79,6 +180,61 @@ public:
     /*! The time in seconds for which the buffer should hold the data. */
   double bufferTime( void ) const;
 
+    /*! The number of new scans after which consumers are notified. */
+  int notifyScans( void ) const;
+    /*! The number of notifications about new data issued so far. */
+  unsigned long notifications( void ) const;
+    /*! Block the calling thread until the acquisition thread issued
+        a notification about new data that is not yet known by
+	\a count, or until \a time milliseconds have passed.
+	\a count is set to the current number of notifications().
+	\return \c true if there are new notifications,
+	\c false on timeout. */
+  bool waitForData( unsigned long &count, unsigned long time=ULONG_MAX );
+
+    /*! The time at which the scans were available to consumers. */
+  struct ClockStamp
+  {
+    ClockStamp( long long index=0 ) : Index( index ), Monotonic( 0 ), Realtime( 0 ) {};
+      /*! The number of scans published so far. */
+    long long Index;
+      /*! CLOCK_MONOTONIC in nanoseconds. */
+    long long Monotonic;
+      /*! CLOCK_REALTIME in nanoseconds. */
+    long long Realtime;
+  };
+    /*! The clock stamps of the published scans. Follow it with
+        a CyclicBufferReader. */
+  const CyclicBuffer< ClockStamp > &clockStamps( void ) const;
+
+    /*! The number of acquisition boards, zero if unknown.
+        The channels of all grids are acquired by the boards
+	in the order of the boards. */
+  int boards( void ) const;
+    /*! The number of channels acquired by board \a b. */
+  int boardChannels( int b ) const;
+
+    /*! A copy of the current statistics of the data acquisition. */
+  AcquisitionStats stats( void ) const;
+    /*! Add the current statistics of the data acquisition to \a opts. */
+  void statsOptions( Options &opts ) const;
+    /*! Add the scheduling policy, priority, and CPU affinity
+        the acquisition thread actually got and whether the memory
+	is locked to \a opts. */
+  void schedulingOptions( Options &opts ) const;
+    /*! Consumers of the input buffer of grid \a g call this
+        with their lag() in data elements for the statistics. */
+  void reportLag( int g, long long lag );
+
+
+signals:
+
+    /*! Emitted from the acquisition thread whenever notifyScans()
+        new scans have been published and when the acquisition thread
+	terminates. Connect it to a slot of a QObject living in another
+	thread for event-driven processing of the data. */
+  void dataAvailable( void );
+
 
 protected:
 
@@ -95,14 +251,163 @@ protected:
     /*! Clear the error flag. */
   void clearError( void );
 
+    /*! \c true if the implementation can store raw ADC counts of
+        at most 16 bit for the configured hardware.
+	start() calls this before allocating the input buffers,
+	so that the buffers never need to be exchanged once
+	consumers are attached to them. The default implementation
+	returns \c true. */
+  virtual bool rawInputSupported( void );
+    /*! Set the calibration polynomial for the raw counts of
+        channel \a c of grid \a g: the value stored in inputBuffer()
+	would be coeffs[0] + coeffs[1]*x + ... + coeffs[order]*x^order
+	with x = raw count - \a origin. \a order must not exceed three. */
+  void setCalibration( int g, int c, int order, double origin, const double *coeffs );
+
+    /*! The maximum number of data elements that can be added at once
+        to grid \a g via pushBuffer() or rawPushBuffer().
+	In blocked layout this does not exceed the current block. */
+  int maxPush( int g ) const;
+    /*! Where to write the next \a n data elements of grid \a g as floats.
+        \a n must not exceed maxPush(). Sample \a s of channel \a c
+	goes to s*scanStride() + c*channelStride(). */
+  float *pushBuffer( int g, int n );
+    /*! Where to write the next \a n data elements of grid \a g as raw counts.
+        \a n must not exceed maxPush(). Sample \a s of channel \a c
+	goes to s*scanStride() + c*channelStride(). */
+  RawSample *rawPushBuffer( int g, int n );
+    /*! The distance between consecutive samples of a channel
+        in the push buffers of grid \a g, i.e. gridChannels()
+	for interleaved data and one in blocked layout. */
+  int scanStride( int g ) const;
+    /*! The distance between the channels of a scan in the push buffers,
+        i.e. one for interleaved data and blockSamples() in blocked layout. */
+  int channelStride( void ) const;
+    /*! Tell that \a n data elements have been written to pushBuffer() or
+        rawPushBuffer() of grid \a g. In blocked layout a completed block
+	is published. */
+  void push( int g, int n );
+    /*! Get the push buffers of all used grids for at most \a scans
+        whole scans, as floats in \a fp or, if rawInput(),
+	as raw counts in \a rp.
+	\return the number of whole scans that can be written at once,
+	zero if there is no space for a single scan. */
+  int claimScans( int scans, float **fp, RawSample **rp );
+    /*! Tell that \a scans whole scans have been written
+        to the push buffers of all used grids. */
+  void pushScans( int scans );
+    /*! Implementations call this whenever the driver reports an overrun. */
+  void countOverrun( void );
+    /*! Implementations call this with the number \a checks of
+        queries of the device status and the \a time in microseconds
+	they took since the last call. */
+  void countStatusChecks( long long checks, long long time );
+    /*! Implementations reading from several devices call this with
+        the difference \a scans in scans available from them. */
+  void countSkew( long long scans );
+    /*! Implementations call this in initialize() with the \a plan
+        routing the channels of their devices to the grids.
+	This also sets the layout of the input buffers in \a plan,
+	so that DemuxPlan::execute() writes directly into the push buffers. */
+  void setBoards( DemuxPlan &plan );
+    /*! Transfer \a scans whole scans of device \a device of \a plan
+        from a buffer of raw counts to the push buffers \a fp or,
+	if rawInput(), \a rp. The raw counts are given by the spans
+	\a d1 of \a n1 and \a d2 of \a n2 data elements as returned by
+	CyclicBuffer::spans(), a scan may wrap from \a d1 to \a d2.
+	Unless rawInput(), the raw counts are converted by \a converter
+	into \a converted, which needs space for \a scans scans,
+	and then demultiplexed. */
+  template < class S >
+  void transferStaged( const DemuxPlan &plan, int device, int scans,
+		       const S *d1, long long n1, const S *d2, long long n2,
+		       const Converter &converter, float *converted,
+		       float **fp, RawSample **rp );
+    /*! Move the \a n \a readers of the buffers of synchronized devices,
+        whose scans have \a scansizes data elements, forward by the same
+	number of whole scans, so that all of them skip the data lost
+	by the reader that was lapped furthest by its producer.
+	The devices thus stay aligned by scans. A reader may end up ahead
+	of its producer and then skips the data the producer adds next.
+	\return the number of skipped scans. */
+  static long long recoverScans( CyclicBufferReader *readers,
+				 const int *scansizes, int n );
+
 
 private:
 
+    /*! Allocate the input buffers for the current mode. */
+  void allocateBuffers( void );
+    /*! Apply the memory options to \a buffer of grid \a g
+        and reserve \a n data elements. */
+  template < class T >
+  void allocateBuffer( CyclicBuffer< T > &buffer, int g, long long n );
+    /*! Notify consumers if enough new scans have been published
+        or if \a force is \c true. */
+  void notify( bool force=false );
+    /*! Write a summary of the statistics to the log. */
+  void logStats( void );
+    /*! Add a clock stamp for the scans published so far. */
+  void stampClocks( void );
+    /*! Apply the requested scheduling policy and CPU affinity
+        to the calling thread and record what was granted. */
+  void applyScheduling( void );
+
     /*! The analog input buffer. */
   CyclicBuffer< float > AIBuffer[ConfigData::MaxGrids];
+    /*! The analog input buffer for raw ADC counts. */
+  CyclicBuffer< RawSample > AIRawBuffer[ConfigData::MaxGrids];
+    /*! Store raw ADC counts. */
+  bool Raw;
+    /*! The calibration polynomials for each channel of each grid. */
+  Converter Calibration[ConfigData::MaxGrids];
+    /*! Number of samples per channel in a block, zero for interleaved data. */
+  int BlockSamples;
+    /*! The number of data elements in the current block of each grid. */
+  int BlockFill[ConfigData::MaxGrids];
   QMutex AIMutex[ConfigData::MaxGrids];
+    /*! Holds a single scan of raw counts that wraps around the end
+        of a buffer in transferStaged(). */
+  vector< long long > WrappedScan;
+
+    /*! The grid whose published data elements are counted for notifications. */
+  int NotifyGrid;
+    /*! The number of scans after which consumers are notified. */
+  int NotifyScans;
+    /*! The number of data elements of NotifyGrid published since the last notification. */
+  long long NotifyFill;
+    /*! The number of notifications issued so far. */
+  unsigned long Notifications;
+  mutable QMutex NotifyMutex;
+  QWaitCondition NotifyCondition;
+
+    /*! The clock stamps of the published scans. */
+  CyclicBuffer< ClockStamp > Clocks;
+    /*! The number of channels of each board. */
+  vector< int > BoardChannels;
+
+    /*! Statistics of the data acquisition. */
+  AcquisitionStats Stats;
+    /*! Time in microseconds of the last summary of the statistics in the log. */
+  long long StatsTime;
+    /*! Interval in microseconds between summaries of the statistics in the log. */
+  long long StatsInterval;
+    /*! Whether start() has been called before. */
+  bool Started;
+    /*! Released by the acquisition thread after applyScheduling(). */
+  QSemaphore Scheduled;
+    /*! The scheduling policy granted to the acquisition thread. */
+  int SchedPolicy;
+    /*! The scheduling priority granted to the acquisition thread. */
+  int SchedPriority;
+    /*! The CPUs the acquisition thread may run on. */
+  string SchedCPUs;
+    /*! Whether the memory of the process is locked. */
+  bool MemoryLocked;
+  mutable QMutex StatsMutex;
 
   bool Run;
+  bool EndOfData;
   mutable QMutex RunMutex;
   ConfigData *CD;
   mutable bool Error;
@@ -110,5 +415,43 @@ private:
 };
 
 
+template < class S >
+void DataThread::transferStaged( const DemuxPlan &plan, int device, int scans,
+				 const S *d1, long long n1, const S *d2, long long n2,
+				 const Converter &converter, float *converted,
+				 float **fp, RawSample **rp )
+{
+  int nc = plan.channels( device );
+  if ( ! rawInput() ) {
+    converter.convert( d1, converted, n1, 0 );
+    if ( n2 > 0 )
+      converter.convert( d2, converted + n1, n2, n1 % nc );
+    plan.execute( device, converted, scans, fp );
+    return;
+  }
+
+  // whole scans of the first span:
+  int s = n1 / nc;
+  if ( s > scans )
+    s = scans;
+  plan.execute( device, d1, s, rp );
+  if ( s >= scans )
+    return;
+  int r = n1 - s*nc;
+  if ( r > 0 ) {
+    // this scan wraps around the end of the buffer:
+    if ( WrappedScan.size()*sizeof( long long ) < nc*sizeof( S ) )
+      WrappedScan.resize( nc );
+    S *scan = (S *)&WrappedScan[0];
+    memcpy( scan, d1 + s*nc, r*sizeof( S ) );
+    memcpy( scan + r, d2, (nc-r)*sizeof( S ) );
+    plan.execute( device, (const S *)scan, 1, rp, s );
+    d2 += nc - r;
+    s++;
+  }
+  plan.execute( device, d2, scans - s, rp, s );
+}
+
+
 #endif /* ! _DATATHREAD_H_ */
 
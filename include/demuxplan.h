@@ -0,0 +1,154 @@
+/*
+  demuxplan.h
+  Precompiled routing of multiplexed device scans to the grids.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DEMUXPLAN_H_
+#define _DEMUXPLAN_H_ 1
+
+#include <vector>
+
+using namespace std;
+
+
+/*!
+\class DemuxPlan
+\brief Precompiled routing of multiplexed device scans to the grids.
+\author Jan Benda
+
+Each device delivers scans of channels(device) interleaved data elements.
+The channels of all devices are assigned to the grids in the order
+of the devices and their channels, skipping blacklisted channels.
+A grid may span several devices and a device may feed several grids.
+
+add() appends the next channel of a device to the next channel of a grid.
+Consecutive channels that go to consecutive channels of the same grid
+are merged into a single run of a source offset within the device scan,
+a destination grid, a destination offset within the grid scan,
+and a count. execute() then copies whole scans run by run,
+without any per-sample lookups or index bookkeeping.
+
+By default the destinations are interleaved like the device scans.
+With setBlockSamples() execute() writes the blocked layout of the
+DataThread input buffers instead, where the samples of each channel
+are contiguous, so that the data do not need to be transposed later on.
+*/
+
+class DemuxPlan
+{
+
+public:
+
+    /*! Constructs an empty plan. */
+  DemuxPlan( void );
+
+    /*! Remove all runs. The layout of the destination is kept. */
+  void clear( void );
+    /*! Append the next channel of \a device to the next channel of \a grid. */
+  void add( int device, int grid );
+
+    /*! The number of devices. */
+  int devices( void ) const;
+    /*! The number of data elements in a scan of \a device. */
+  int channels( int device ) const;
+    /*! The number of grids. */
+  int grids( void ) const;
+    /*! The number of data elements in a scan of \a grid,
+        i.e. the stride of the destination. */
+  int gridChannels( int grid ) const;
+    /*! The number of runs of \a device. */
+  int runs( int device ) const;
+    /*! The total number of runs of all devices. */
+  int runs( void ) const;
+
+    /*! Write the destinations in blocks of \a samples samples per
+        channel, or interleaved if \a samples is zero. */
+  void setBlockSamples( int samples );
+    /*! The number of samples per channel in a block of the destinations,
+        zero for interleaved destinations. */
+  int blockSamples( void ) const;
+
+    /*! Copy \a scans whole scans of \a device from \a source to the grids.
+        The data of grid \a g are written to \a dest[g] starting with
+        scan \a destscan of the grid. In blocked layout sample \a s
+	of channel \a c goes to dest[g][c*blockSamples() + destscan + s],
+	so \a destscan + \a scans must not exceed blockSamples(). */
+  template < class S, class D >
+  void execute( int device, const S *source, int scans, D **dest, int destscan=0 ) const;
+
+
+private:
+
+  struct Run
+  {
+    int Source;
+    int Grid;
+    int Dest;
+    int Count;
+  };
+
+  vector< vector< Run > > Runs;
+  vector< int > Channels;
+  vector< int > GridChannels;
+  int BlockSamples;
+
+};
+
+
+template < class S, class D >
+void DemuxPlan::execute( int device, const S *source, int scans, D **dest, int destscan ) const
+{
+  const vector< Run > &runs = Runs[device];
+  int nc = Channels[device];
+  if ( BlockSamples > 0 ) {
+    // the samples of each channel are contiguous:
+    for ( unsigned int r=0; r<runs.size(); r++ ) {
+      const Run &run = runs[r];
+      for ( int k=0; k<run.Count; k++ ) {
+	const S *sp = source + run.Source + k;
+	D *dp = dest[run.Grid] + ( run.Dest + k )*BlockSamples + destscan;
+	for ( int s=0; s<scans; s++ )
+	  dp[s] = (D)sp[s*nc];
+      }
+    }
+    return;
+  }
+  for ( unsigned int r=0; r<runs.size(); r++ ) {
+    const Run &run = runs[r];
+    int stride = GridChannels[run.Grid];
+    const S *sp = source + run.Source;
+    D *dp = dest[run.Grid] + destscan*stride + run.Dest;
+    if ( run.Count == nc && stride == nc ) {
+      // the scans of the device are the scans of the grid:
+      for ( int k=0; k<scans*nc; k++ )
+	dp[k] = (D)sp[k];
+      continue;
+    }
+    for ( int s=0; s<scans; s++ ) {
+      for ( int k=0; k<run.Count; k++ )
+	dp[k] = (D)sp[k];
+      sp += nc;
+      dp += stride;
+    }
+  }
+}
+
+
+#endif /* ! _DEMUXPLAN_H_ */
+
@@ -24,6 +24,7 @@
 
 #include <iostream>
 #include <QDateTime>
+#include <QTimer>
 #include <relacs/optdialog.h>
 #include "recording.h"
 #include "cyclicbuffer.h"
@@ -48,6 +49,10 @@ File saving:
 - \c Return : start/stop saving recording to a file
 - \c Backspace : make a time stamp
 
+Acquisition:
+- \c CTRL-O : estimate the temporal offsets between the boards
+  from the last seconds of data and store them in the configuration
+
 */
 
 
@@ -67,16 +72,18 @@ public:
       \param[in] gain the gain of the amplifiers
       \param[in] buffertime the time in seconds for which the buffer should hold the data
       \param[in] datatime the size of the data segements in seconds on which analysis operates on
-      \param[in] datainterval the time between calls to processData() in seconds
+      \param[in] datainterval the time between analyses of the data in seconds
       \param[in] dialog open a configuration dialog
       \param[in] saving start saving right away
       \param[in] stoptime stop saving and quit at this time
-      \param[in] simulate start in simulation mode */
+      \param[in] simulate start in simulation mode
+      \param[in] replay if not empty, replay the recording in this directory */
   FishGridWidget( double samplerate,
 		  double maxvolts, double gain,
 		  double buffertime,
 		  double datatime, double datainterval,
-		  bool dialog, bool saving, const string &stoptime, bool simulate );
+		  bool dialog, bool saving, const string &stoptime, bool simulate,
+		  const string &replay="" );
   ~FishGridWidget( void );
 
 
@@ -85,7 +92,10 @@ public slots:
     /*! Start data acquisition. */
   void start( void );
 
-    /*! Processes data (save to disk, analyse, and plot). */
+    /*! Processes data (save to disk, analyse, and plot).
+        Called whenever the data thread published new data.
+	The data are saved right away, but analysed and plotted
+	only every data interval. */
   void processData( void );
 
     /*! Stops all FishGridWidget activities and exits. */
@@ -103,10 +113,18 @@ protected:
   inline CyclicBuffer< float > &inputBuffer( int g ) { return DataLoop->inputBuffer( g ); };
     /*! The analog input buffer of grid \a g. */
   inline const CyclicBuffer< float > &inputBuffer( int g ) const { return DataLoop->inputBuffer( g ); };
+    /*! Sizes and indices of the analog input buffer of grid \a g,
+        independent of whether it stores floats or raw samples. */
+  inline const CyclicBufferBase &inputRing( int g ) const { return DataLoop->inputRing( g ); };
     /*! Lock the analog input mutex of grid \a g. */
   void lockAI( int g );
     /*! Unlock the analog input mutex of gid \a g. */
   void unlockAI( int g );
+    /*! Estimate the temporal offsets between the boards of the
+        data acquisition from the common-mode signals of the most
+	recent \a time seconds of data and set the "offset" options
+	of the acquisition accordingly. */
+  void estimateOffsets( double time=4.0 );
 
 
 protected slots:
@@ -127,9 +145,21 @@ private:
   bool StopRecording;
     /*! Stop recording at this time. */
   QDateTime StopTime;
+    /*! A recording is replayed, whose configuration must not be saved
+        into the user's configuration file. */
+  bool Replay;
 
     /*! Acquire the data. */
   DataThread *DataLoop;
+    /*! Buffer for converting raw data. */
+  vector< float > ConvertBuffer;
+    /*! Time since the data have been analyzed last. */
+  QTime ProcessTime;
+    /*! Calls processData() every ProcessInterval milliseconds,
+        in case the data thread stalls without notifying. */
+  QTimer ProcessTimer;
+    /*! The most recent status message of FileSaver. */
+  string SaveMessage;
 
     /*! The dialog for the meta data. */
   OptDialog *MetadataDialog;
@@ -22,7 +22,10 @@
 #ifndef _NIDAQMXTHREAD_H_
 #define _NIDAQMXTHREAD_H_ 1
 
+#include <vector>
 #include <NIDAQmxBase.h>
+#include "converter.h"
+#include "demuxplan.h"
 #include "datathread.h"
 
 using namespace std;
@@ -32,6 +35,16 @@ using namespace std;
 \class NIDAQmxThread
 \brief DataThread implementation for acquisition of data using NIDAQmxBase
 \author Jan Benda
+
+By default the samples are read as scaled voltages in double precision.
+If the "binary" option is set, read() reads the unscaled 16 bit
+samples of the ADC instead, converts them with a Converter
+and routes them by a DemuxPlan to the push buffers of the grids.
+If all channels go to a single grid, they are converted directly into
+its push buffer. This moves a quarter of the bytes per sample.
+The unscaled samples are converted with the nominal gain of the input
+range of the USB-621x devices, i.e. without the device calibration.
+In raw input mode the samples are stored as offset binary counts.
 */
 
 class NIDAQmxThread : public DataThread
@@ -44,6 +57,7 @@ public:
 
 protected:
 
+  virtual bool rawInputSupported( void );
   virtual int initialize( double duration=0.0 );
   virtual void finish( void );
   virtual int read( void );
@@ -51,8 +65,28 @@ protected:
 
 private:
 
-    TaskHandle Handle;
-
+    /*! Transfer \a scans scans from the staging buffer to the grids.
+        \return 0 on success, -1 if there is no space in the input buffers. */
+  int transferScans( int scans );
+
+    /*! The acquisition task. */
+  TaskHandle Handle;
+    /*! Read unscaled 16 bit samples. */
+  bool Binary;
+    /*! The number of scans read at once. */
+  int ReadScans;
+    /*! Staging buffer for unscaled samples. */
+  vector< int16 > BinaryData;
+    /*! Staging buffer for scaled samples. */
+  vector< float64 > ScaledData;
+    /*! Samples converted to voltages before they are routed to the grids. */
+  vector< float > Converted;
+    /*! Conversion of the unscaled samples into voltages. */
+  Converter Convert;
+    /*! The routing of the channels to the grids. */
+  DemuxPlan Plan;
+    /*! The grid taking all channels, or -1. */
+  int DirectGrid;
 
 };
 
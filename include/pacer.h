@@ -0,0 +1,84 @@
+/*
+  pacer.h
+  Paces the generation of scans against absolute deadlines.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PACER_H_
+#define _PACER_H_ 1
+
+
+/*!
+\class Pacer
+\brief Paces the generation of scans against absolute deadlines.
+\author Jan Benda
+
+DataThread implementations that produce their data themselves, like
+SimulationThread and ReplayThread, use a Pacer to deliver the scans
+at the rate of a real acquisition. start() sets the first deadline
+one interval from now. wait() sleeps until the next deadline on
+the monotonic clock and returns the total number of scans due since
+start(). Since the deadlines are absolute, the time needed for
+producing the scans does not accumulate into a drift, and scans
+that could not be produced in time are due at the next deadline.
+*/
+
+class Pacer
+{
+
+public:
+
+    /*! Constructs a Pacer. Call start() before wait(). */
+  Pacer( void );
+
+    /*! Start pacing \a rate scans per second with a deadline
+        every \a scans scans. */
+  void start( double rate, int scans );
+    /*! Sleep until the next deadline.
+        \return the number of scans due from start() up to this deadline. */
+  long long wait( void );
+    /*! \c true if the last wait() found the caller more than
+        a second behind the deadlines for the first time
+	since it was on time. Use this for warning once about
+	not keeping up. */
+  bool fellBehind( void ) const;
+
+    /*! CLOCK_MONOTONIC in nanoseconds. */
+  static long long nanoseconds( void );
+
+
+private:
+
+    /*! The number of scans per second. */
+  double Rate;
+    /*! Start time in nanoseconds. */
+  long long StartTime;
+    /*! The next deadline in nanoseconds. */
+  long long Deadline;
+    /*! Interval between deadlines in nanoseconds. */
+  long long Interval;
+    /*! More than a second behind the deadlines and not caught up since. */
+  bool Behind;
+    /*! The last wait() set Behind. */
+  bool FellBehind;
+
+};
+
+
+#endif /* ! _PACER_H_ */
+
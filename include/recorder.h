@@ -35,6 +35,9 @@
 #ifdef HAVE_NIDAQMXBASE_H
 #include "nidaqmxthread.h"
 #endif
+#ifdef HAVE_LIBUSB_1_0_LIBUSB_H
+#include "daqflexthread.h"
+#endif
 
 using namespace std;
 using namespace relacs;
@@ -66,12 +69,15 @@ public:
 
     /*! Start data acquisition. */
   int start( void );
-    /*! Processes data (save to disk, analyse, and plot). */
+    /*! Processes data (save to disk, analyse, and plot).
+        \return 1 if all data have been acquired, 0 on success,
+	or the error code of restarting the data thread. */
   int processData( void );
     /*! Stops all FishGridWidget activities and exits. */
   void finish( void );
 
-    /*! Sleep for the data process interval. */
+    /*! Wait until the data thread notifies about new data,
+        but at most for the data process interval. */
   void sleep( void );
 
     /*! The main server loop for establishing and handling of connections. */
@@ -94,6 +100,8 @@ private:
   Recording FileSaver;
 
   DataThread *DataLoop;
+    /*! The number of data notifications seen by sleep(). */
+  unsigned long DataNotifications;
 
   bool FileSaving;
   QMutex FileSavingMutex;
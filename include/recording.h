@@ -23,9 +23,11 @@
 #define _RECORDING_H_ 1
 
 #include <fstream>
+#include <vector>
 #include <relacs/configclass.h>
 #include "configdata.h"
 #include "datathread.h"
+#include "cyclicbufferreader.h"
 
 using namespace std;
 using namespace relacs;
@@ -35,6 +37,12 @@ using namespace relacs;
 \class Recording
 \brief Records data to disc
 \author Jan Benda
+
+Along with the trace files a binary clock-map file \c clockmap.dat
+is written. For each of the DataThread::clockStamps() it contains
+a record of 24 bytes, three signed 64-bit little-endian integers:
+the number of scans recorded in the trace files, and CLOCK_MONOTONIC
+and CLOCK_REALTIME in nanoseconds at which these scans were acquired.
 */
 
 class Recording : public ConfigClass
@@ -56,7 +64,7 @@ public:
   string start( bool tracefiles=true, bool timestamps=true );
   /*! Open files for storing raw data of the traces.
       \a name is used for creating the names of the files:
-      \c traces-grid1NAME.raw */
+      \c traces-grid1NAME.raw and \c clockmapNAME.dat */
   void openTraceFiles( const string &name="" );
     /*! Close all open trace files. */
   void closeTraceFiles( void );
@@ -67,6 +75,8 @@ public:
 
     /*! \return \c true if we are currently saving data to disc. */
   bool saving( void ) const;
+    /*! The path of the current recording. */
+  string path( void ) const;
 
     /*! Records a time stamp. */
   void timeStamp( void );
@@ -85,6 +95,10 @@ public:
 
 private:
 
+    /*! Add a section of type \a type with the parameters \a opts
+        to the metadata file of the current recording. */
+  void appendMetaData( const string &type, const Options &opts );
+
   ConfigData *CD;
   DataThread *DT;
 
@@ -104,8 +118,20 @@ private:
   bool TraceFilesOpen;
     /*! Index of the first saved data points for each grid. */
   long long FirstTraceIndex[ConfigData::MaxGrids];
-    /*! So far saved data points for each grids. */
-  long long TraceIndex[ConfigData::MaxGrids];
+    /*! Read cursors into the input buffers for saving the data of each grid. */
+  CyclicBufferReader TraceReader[ConfigData::MaxGrids];
+    /*! Binary file for the clock stamps. */
+  ofstream ClockFile;
+    /*! Read cursor into the clock stamps of the DataThread. */
+  CyclicBufferReader ClockReader;
+    /*! The number of scans acquired before the trace files were opened. */
+  long long FirstClockIndex;
+    /*! Buffer for converting raw data before writing them to disc. */
+  vector< float > ConvertBuffer;
+    /*! Buffer for interleaving blocked data before writing them to disc. */
+  vector< float > TransposeBuffer;
+    /*! Buffer for copying the clock stamps before writing them to disc. */
+  vector< DataThread::ClockStamp > ClockBuffer;
     /*! Time and date of the start of the recording. */
   QDateTime StartRecTime;
 
@@ -118,6 +144,25 @@ private:
     /*! Number of the time stamp. */
   int TimeStampNum;
 
+    /*! Write the data of grid \a g from index \a from upto index \a upto
+        as interleaved floats to the trace file.
+	In blocked layout \a from and \a upto need to be multiples of
+	DataThread::blockSize(). Interleaved floats are written directly
+	out of the spans of the input buffer and validated by TraceReader
+	afterwards. Data that were overwritten while they were written
+	remain in the file and are counted as lost. Raw or blocked data
+	are copied out of the input buffer, converted, and validated
+	before they are written. Data that were overwritten while they
+	were copied are not written and counted as lost.
+        \return the number of processed data elements or a negative
+	error code as returned by CyclicBuffer::spans(). */
+  long long saveTraces( int g, long long from, long long upto );
+    /*! Write the new clock stamps to the clock-map file. */
+  void saveClocks( void );
+    /*! Immediately save a time stamp with comment \a comment
+        without modifying the time stamp returned by timeStampOpts(). */
+  void eventTimeStamp( const string &comment );
+
     /*! The log-file. */
   ofstream *LogFile;
 
@@ -0,0 +1,122 @@
+/*
+  replaythread.h
+  DataThread implementation for replaying recorded data
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+  
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _REPLAYTHREAD_H_
+#define _REPLAYTHREAD_H_ 1
+
+#include <string>
+#include <vector>
+#include "datathread.h"
+#include "pacer.h"
+
+using namespace std;
+
+
+/*! 
+\class ReplayThread
+\brief DataThread implementation for replaying recorded data
+\author Jan Benda
+
+Streams the traces-gridN.raw files of a recording into the input
+buffers, as if they were acquired by a board. The files are mapped
+into memory and copied in whole scans into the push buffers. The
+layout of the grids and the sampling rate need to be the ones of the
+recording, i.e. the fishgrid.cfg of the recording needs to be read
+into the configuration before start().
+
+The "speed" option sets the rate of the replay relative to real time.
+Like SimulationThread the replay is then paced against absolute
+deadlines every "readinterval" seconds. With a speed of zero the data
+are replayed as fast as possible, "readinterval" seconds per read().
+When the end of the recording is reached, the replay starts over
+if "loop" is set, otherwise the thread terminates and reports
+DataThread::endOfData(), upon which FishGridWidget quits.
+
+The time stamps of the recording in timestamps.dat are written to
+the log when the replay passes them.
+*/
+
+class ReplayThread : public DataThread
+{
+
+public:
+
+    /*! Replay the recording in the directory \a path. */
+  ReplayThread( const string &path, ConfigData *cd );
+
+    /*! The directory of the replayed recording. */
+  string path( void ) const;
+
+
+protected:
+
+  virtual bool rawInputSupported( void );
+  virtual int initialize( double duration=0.0 );
+  virtual void finish( void );
+  virtual int read( void );
+
+
+private:
+
+    /*! Read in the time stamps of the recording. */
+  void readTimeStamps( void );
+    /*! Log the time stamps before scan \a scan that have not been logged yet. */
+  void logTimeStamps( long long scan );
+    /*! Copy \a scans scans starting at scan \a pos of all grids
+        into their push buffers. */
+  int transferScans( long long pos, long long scans );
+
+    /*! The directory of the recording. */
+  string Path;
+    /*! The memory-mapped trace files of each grid. */
+  const float *Traces[ConfigData::MaxGrids];
+    /*! The size of the mapped trace files in bytes. */
+  size_t TraceSize[ConfigData::MaxGrids];
+    /*! The number of scans in the recording. */
+  long long Scans;
+    /*! The scan of the recording to be replayed next. */
+  long long Position;
+    /*! Copies the interleaved scans of each grid into the layout of its input buffer. */
+  DemuxPlan Plan;
+
+    /*! The scans of the time stamps of the recording. */
+  vector< long long > TimeStampScans;
+    /*! The descriptions of the time stamps of the recording. */
+  vector< string > TimeStamps;
+    /*! The next time stamp to be logged. */
+  unsigned int NextTimeStamp;
+
+    /*! Replay speed relative to real time, zero for as fast as possible. */
+  double Speed;
+  bool Loop;
+  long long Samples;
+  long long MaxSamples;
+    /*! Number of scans replayed per read() if not paced. */
+  int ReadScans;
+    /*! Paces read() at the replay speed. */
+  Pacer Pace;
+
+};
+
+
+#endif /* ! _REPLAYTHREAD_H_ */
+
@@ -24,6 +24,7 @@
 
 #include <vector>
 #include "datathread.h"
+#include "pacer.h"
 
 using namespace std;
 
@@ -32,6 +33,20 @@ using namespace std;
 \class SimulationThread
 \brief DataThread implementation for simulating data of a moving fish
 \author Jan Benda
+
+Each grid gets a sine wave of its own frequency, precomputed for a
+single period. The amplitude on each electrode falls off with the
+squared distance to the simulated fish. These gains are computed
+for all channels of a grid once per read() and then multiplied with
+the waveform directly into the push buffers.
+
+With the "realtime" option set, read() paces itself via a Pacer against absolute
+deadlines every "readinterval" seconds on the monotonic clock and
+produces all scans that are due at the deadline. Time spent for
+generating the data therefore does not accumulate into a drift, and
+scans that could not be generated in time are made up at the next
+deadline. Without it, read() produces the scans of one "readinterval"
+as fast as possible, for stress-testing the consumers of the data.
 */
 
 class SimulationThread : public DataThread
@@ -51,20 +66,43 @@ protected:
 
 private:
 
+    /*! Update the position of the fish in grid \a g for \a n scans
+        and the gains of its channels accordingly. */
+  void updateGains( int g, int n );
+    /*! Write \a n scans of grid \a g into its push buffer.
+        \return 0 on success, -1 if the input buffer has no space. */
+  int generate( int g, int n );
+
   bool FixedPos;
+  bool RealTime;
+    /*! One period of the waveform of each grid. */
   vector<float> Sine[ConfigData::MaxGrids];
+    /*! The current index into the waveform of each grid. */
+  int Phase[ConfigData::MaxGrids];
+    /*! The gain of each channel of each grid. */
+  vector<float> Gains[ConfigData::MaxGrids];
+    /*! The gains of the channels of a grid scaled to raw counts. */
+  vector<float> RawGains;
+    /*! The column and row of each channel of each grid. */
+  vector<float> ChannelX[ConfigData::MaxGrids];
+  vector<float> ChannelY[ConfigData::MaxGrids];
   double Amplitude;
   double X[ConfigData::MaxGrids];
   double Y[ConfigData::MaxGrids];
+    /*! The scans of each grid since the last step of the random walk. */
+  int WalkScans[ConfigData::MaxGrids];
 
   static const double D = 20.0;
   static const double Tau = 6000.0;
 
-  int Samples;
-  int MaxSamples;
+  long long Samples;
+  long long MaxSamples;
+    /*! Number of scans generated per read(). */
+  int ReadScans;
+    /*! Paces read() in real time. */
+  Pacer Pace;
 
 };
 
 
 #endif /* ! _SIMULATIONTHREAD_H_ */
-
@@ -0,0 +1,269 @@
+/*
+  acquisitionstats.cc
+  Counters and histograms monitoring the data acquisition.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <time.h>
+#include <relacs/str.h>
+#include "acquisitionstats.h"
+
+using namespace std;
+using namespace relacs;
+
+
+AcquisitionStats::Histogram::Histogram( void )
+{
+  clear();
+}
+
+
+void AcquisitionStats::Histogram::clear( void )
+{
+  for ( int k=0; k<Bins; k++ )
+    Counts[k] = 0;
+  Count = 0;
+  Sum = 0.0;
+  Max = 0;
+}
+
+
+void AcquisitionStats::Histogram::add( long long x )
+{
+  int k = 0;
+  while ( k < Bins-1 && ( x >> k ) > 0 )
+    k++;
+  Counts[k]++;
+  Count++;
+  Sum += x;
+  if ( Count == 1 || x > Max )
+    Max = x;
+}
+
+
+long long AcquisitionStats::Histogram::count( void ) const
+{
+  return Count;
+}
+
+
+double AcquisitionStats::Histogram::mean( void ) const
+{
+  return Count > 0 ? Sum/Count : 0.0;
+}
+
+
+long long AcquisitionStats::Histogram::max( void ) const
+{
+  return Max;
+}
+
+
+long long AcquisitionStats::Histogram::quantile( double p ) const
+{
+  if ( Count <= 0 )
+    return 0;
+  long long n = (long long)::ceil( p*Count );
+  if ( n < 1 )
+    n = 1;
+  long long c = 0;
+  for ( int k=0; k<Bins; k++ ) {
+    c += Counts[k];
+    if ( c >= n ) {
+      long long upper = k > 0 ? ( 1LL << k ) - 1 : 0;
+      return upper < Max ? upper : Max;
+    }
+  }
+  return Max;
+}
+
+
+string AcquisitionStats::Histogram::str( const string &unit ) const
+{
+  return "n=" + Str( (long)Count )
+    + " mean=" + Str( mean(), "%.1f" ) + unit
+    + " median<=" + Str( (long)quantile( 0.5 ) ) + unit
+    + " 99%<=" + Str( (long)quantile( 0.99 ) ) + unit
+    + " max=" + Str( (long)Max ) + unit;
+}
+
+
+AcquisitionStats::AcquisitionStats( void )
+{
+  clear( microseconds() );
+}
+
+
+void AcquisitionStats::clear( long long time )
+{
+  StartTime = time;
+  ReadTime.clear();
+  ReadScans.clear();
+  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
+    Lag[g].clear();
+    Fill[g] = 0.0;
+    MaxFill[g] = 0.0;
+  }
+  Overruns = 0;
+  Restarts = 0;
+  StatusChecks = 0;
+  StatusTime = 0;
+  Skew.clear();
+}
+
+
+long long AcquisitionStats::microseconds( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (long long)ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
+
+
+void AcquisitionStats::addRead( long long time, long long scans )
+{
+  ReadTime.add( time );
+  ReadScans.add( scans );
+}
+
+
+void AcquisitionStats::addLag( int g, long long lag, long long capacity )
+{
+  Lag[g].add( lag );
+  Fill[g] = capacity > 0 ? (double)lag/capacity : 0.0;
+  if ( Fill[g] > MaxFill[g] )
+    MaxFill[g] = Fill[g];
+}
+
+
+void AcquisitionStats::addOverrun( void )
+{
+  Overruns++;
+}
+
+
+void AcquisitionStats::addRestart( void )
+{
+  Restarts++;
+}
+
+
+void AcquisitionStats::addStatusChecks( long long checks, long long time )
+{
+  StatusChecks += checks;
+  StatusTime += time;
+}
+
+
+void AcquisitionStats::addSkew( long long scans )
+{
+  Skew.add( scans );
+}
+
+
+const AcquisitionStats::Histogram &AcquisitionStats::readTime( void ) const
+{
+  return ReadTime;
+}
+
+
+const AcquisitionStats::Histogram &AcquisitionStats::readScans( void ) const
+{
+  return ReadScans;
+}
+
+
+const AcquisitionStats::Histogram &AcquisitionStats::lag( int g ) const
+{
+  return Lag[g];
+}
+
+
+double AcquisitionStats::fill( int g ) const
+{
+  return Fill[g];
+}
+
+
+double AcquisitionStats::maxFill( int g ) const
+{
+  return MaxFill[g];
+}
+
+
+long long AcquisitionStats::overruns( void ) const
+{
+  return Overruns;
+}
+
+
+long long AcquisitionStats::restarts( void ) const
+{
+  return Restarts;
+}
+
+
+long long AcquisitionStats::statusChecks( void ) const
+{
+  return StatusChecks;
+}
+
+
+long long AcquisitionStats::statusTime( void ) const
+{
+  return StatusTime;
+}
+
+
+const AcquisitionStats::Histogram &AcquisitionStats::skew( void ) const
+{
+  return Skew;
+}
+
+
+double AcquisitionStats::throughput( long long time ) const
+{
+  if ( time <= StartTime )
+    return 0.0;
+  return ReadScans.count()*ReadScans.mean()/( 1.0e-6*( time - StartTime ) );
+}
+
+
+void AcquisitionStats::options( Options &opts, long long time ) const
+{
+  opts.addText( "ReadTime", ReadTime.str( "us" ) );
+  opts.addText( "ReadScans", ReadScans.str() );
+  opts.addNumber( "Throughput", throughput( time ), "Hz", "%.1f" );
+  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
+    if ( Lag[g].count() > 0 ) {
+      opts.addText( "Lag" + Str( g+1 ), Lag[g].str() );
+      opts.addNumber( "Fill" + Str( g+1 ), 100.0*Fill[g], "%", "%.1f" );
+      opts.addNumber( "MaxFill" + Str( g+1 ), 100.0*MaxFill[g], "%", "%.1f" );
+    }
+  }
+  opts.addInteger( "Overruns", (long)Overruns );
+  opts.addInteger( "Restarts", (long)Restarts );
+  if ( StatusChecks > 0 ) {
+    opts.addInteger( "StatusChecks", (long)StatusChecks );
+    opts.addNumber( "StatusCheckTime", (double)StatusTime/StatusChecks, "us", "%.0f" );
+  }
+  if ( Skew.count() > 0 )
+    opts.addText( "Skew", Skew.str() );
+}
+
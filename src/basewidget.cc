@@ -352,6 +352,10 @@ void BaseWidget::keyPressEvent( QKeyEvent *event )
       break;
 
     case Qt::Key_O :
+      if ( event->modifiers() & Qt::ControlModifier ) {
+	event->ignore();
+	return;
+      }
       AnalyzerWidgets[CurrentAnalyzer]->dialog();
       break;
 
@@ -0,0 +1,297 @@
+/*
+  boardoffsets.cc
+  Estimates the temporal offsets between acquisition boards.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <fstream>
+#include <deque>
+#include <relacs/str.h>
+#include <relacs/strqueue.h>
+#include <relacs/options.h>
+#include "boardoffsets.h"
+
+using namespace relacs;
+
+
+BoardOffsets::BoardOffsets( void )
+  : MaxLag( 100 )
+{
+}
+
+
+void BoardOffsets::setBoards( const vector< int > &boardchannels )
+{
+  BoardChannels = boardchannels;
+  Offsets.assign( BoardChannels.size(), 0 );
+  Correlations.assign( BoardChannels.size(), 0.0 );
+}
+
+
+int BoardOffsets::boards( void ) const
+{
+  return BoardChannels.size();
+}
+
+
+int BoardOffsets::boardChannels( int b ) const
+{
+  return BoardChannels[b];
+}
+
+
+void BoardOffsets::setMaxLag( int maxlag )
+{
+  MaxLag = maxlag > 0 ? maxlag : 0;
+}
+
+
+int BoardOffsets::maxLag( void ) const
+{
+  return MaxLag;
+}
+
+
+int BoardOffsets::estimate( const float *data, int channels, int scans )
+{
+  int nb = boards();
+  int nc = 0;
+  for ( int b=0; b<nb; b++ )
+    nc += BoardChannels[b];
+  if ( nb < 2 || nc > channels || scans <= 0 )
+    return -1;
+
+  // common-mode signal of each board:
+  vector< vector< double > > common( nb, vector< double >( scans, 0.0 ) );
+  for ( int s=0; s<scans; s++ ) {
+    const float *dp = data + (long long)s*channels;
+    for ( int b=0; b<nb; b++ ) {
+      double sum = 0.0;
+      for ( int k=0; k<BoardChannels[b]; k++ )
+	sum += *dp++;
+      common[b][s] = BoardChannels[b] > 0 ? sum/BoardChannels[b] : 0.0;
+    }
+  }
+
+  // cross-correlate with the first board:
+  int maxlag = MaxLag < scans ? MaxLag : scans-1;
+  Offsets[0] = 0;
+  Correlations[0] = 1.0;
+  for ( int b=1; b<nb; b++ )
+    Offsets[b] = lag( common[0], common[b], maxlag, Correlations[b] );
+  return 0;
+}
+
+
+int BoardOffsets::offset( int b ) const
+{
+  return Offsets[b];
+}
+
+
+double BoardOffsets::correlation( int b ) const
+{
+  return Correlations[b];
+}
+
+
+int BoardOffsets::lag( const vector< double > &x, const vector< double > &y,
+		       int maxlag, double &corr )
+{
+  corr = 0.0;
+  int n = x.size() < y.size() ? x.size() : y.size();
+  if ( n <= 0 )
+    return 0;
+
+  // zero padded to avoid circular wrap-around within maxlag:
+  int nfft = 1;
+  while ( nfft < n + maxlag )
+    nfft *= 2;
+
+  // remove means:
+  double xm = 0.0;
+  double ym = 0.0;
+  for ( int k=0; k<n; k++ ) {
+    xm += x[k];
+    ym += y[k];
+  }
+  xm /= n;
+  ym /= n;
+  vector< double > xre( nfft, 0.0 );
+  vector< double > xim( nfft, 0.0 );
+  vector< double > yre( nfft, 0.0 );
+  vector< double > yim( nfft, 0.0 );
+  double xx = 0.0;
+  double yy = 0.0;
+  for ( int k=0; k<n; k++ ) {
+    xre[k] = x[k] - xm;
+    yre[k] = y[k] - ym;
+    xx += xre[k]*xre[k];
+    yy += yre[k]*yre[k];
+  }
+  if ( xx <= 0.0 || yy <= 0.0 )
+    return 0;
+
+  // cross spectrum conj(X)*Y:
+  fft( xre, xim, false );
+  fft( yre, yim, false );
+  for ( int k=0; k<nfft; k++ ) {
+    double re = xre[k]*yre[k] + xim[k]*yim[k];
+    double im = xre[k]*yim[k] - xim[k]*yre[k];
+    xre[k] = re;
+    xim[k] = im;
+  }
+  fft( xre, xim, true );
+
+  // maximum of sum_i x[i]*y[i+lag]:
+  int maxinx = 0;
+  double maxc = xre[0];
+  for ( int l=-maxlag; l<=maxlag; l++ ) {
+    double c = xre[l < 0 ? nfft+l : l];
+    if ( c > maxc ) {
+      maxc = c;
+      maxinx = l;
+    }
+  }
+  corr = maxc/::sqrt( xx*yy );
+  return maxinx;
+}
+
+
+void BoardOffsets::fft( vector< double > &re, vector< double > &im, bool inverse )
+{
+  int n = re.size();
+
+  // bit reversal:
+  for ( int i=1, j=0; i<n; i++ ) {
+    int bit = n >> 1;
+    for ( ; j & bit; bit >>= 1 )
+      j ^= bit;
+    j ^= bit;
+    if ( i < j ) {
+      double t = re[i];
+      re[i] = re[j];
+      re[j] = t;
+      t = im[i];
+      im[i] = im[j];
+      im[j] = t;
+    }
+  }
+
+  // butterflies:
+  for ( int len=2; len<=n; len <<= 1 ) {
+    double a = 2.0*M_PI/len*(inverse ? 1.0 : -1.0);
+    double wre = ::cos( a );
+    double wim = ::sin( a );
+    for ( int i=0; i<n; i+=len ) {
+      double ure = 1.0;
+      double uim = 0.0;
+      for ( int k=0; k<len/2; k++ ) {
+	int p = i + k;
+	int q = p + len/2;
+	double tre = re[q]*ure - im[q]*uim;
+	double tim = re[q]*uim + im[q]*ure;
+	re[q] = re[p] - tre;
+	im[q] = im[p] - tim;
+	re[p] += tre;
+	im[p] += tim;
+	double t = ure*wre - uim*wim;
+	uim = ure*wim + uim*wre;
+	ure = t;
+      }
+    }
+  }
+
+  if ( inverse ) {
+    for ( int k=0; k<n; k++ ) {
+      re[k] /= n;
+      im[k] /= n;
+    }
+  }
+}
+
+
+int BoardOffsets::saveOffsets( const string &configfile, const vector< int > &offsets,
+			       const vector< int > &channeloffsets )
+{
+  ifstream sf( configfile.c_str() );
+  if ( ! sf.good() )
+    return -1;
+  deque< StrQueue > config;
+  string line = "";
+  StrQueue sq;
+  while ( true ) {
+    sq.clear();
+    sq.load( sf, "*", &line );
+    config.push_back( sq );
+    if ( ! sf.good() )
+      break;
+  }
+  sf.close();
+
+  ofstream df( configfile.c_str() );
+  for ( unsigned int k=0; k<config.size(); k++ ) {
+    if ( config[k].empty() )
+      continue;
+    string title = config[k][0];
+    df << title << '\n';
+    config[k].erase( 0 );
+    // Fix empty and comma options (for backwards compatibility):
+    for ( int i=0; i<config[k].size(); i++ ) {
+      int f = config[k][i].findFirstNot( Str::WhiteSpace );
+      int p = config[k][i].findLastNot( Str::WhiteSpace );
+      if ( f >= 4 && p > 0 && config[k][i][p] == ':' )
+	config[k][i] += " ~";
+      string val = config[k][i].value( 0, ":" );
+      if ( val.find( ',' ) != string::npos && val[0] != '"' ) {
+	config[k][i].erase( config[k][i].find( ':' ) );
+	config[k][i] += ": \"" + val + "\"";
+      }
+    }
+    Options opt( config[k] );
+    if ( config[k].size() > 0 && title == "*FishGrid" ) {
+      for ( unsigned int g=0; g<channeloffsets.size(); g++ ) {
+	string ns = Str( g+1 );
+	if ( !opt.exist( "ChannelOffset"+ns ) ) {
+	  if ( opt.exist( "ElectrodeType"+ns ) )
+	    opt.insertInteger( "ChannelOffset"+ns, "ElectrodeType"+ns, 0 );
+	  else
+	    opt.addInteger( "ChannelOffset"+ns, 0 );
+	}
+	opt.setInteger( "ChannelOffset"+ns, channeloffsets[g] );
+      }
+    }
+    else if ( config[k].size() > 0 && title == "*Acquisition" ) {
+      for ( unsigned int board=0; board<offsets.size(); board++ ) {
+	string ns = Str( board+1 );
+	if ( !opt.exist( "offset"+ns ) ) {
+	  if ( opt.exist( "blacklist"+ns ) )
+	    opt.insertInteger( "offset"+ns, "blacklist"+ns, 0 );
+	  else
+	    opt.addInteger( "offset"+ns, 0 );
+	}
+	opt.setInteger( "offset"+ns, offsets[board] );
+      }
+    }
+    opt.save( df, "  " );
+    df << '\n';
+  }
+  return 0;
+}
+
@@ -31,6 +31,7 @@
 #include <relacs/optdialog.h>
 #include "preprocessor.h"
 #include "analyzer.h"
+#include "boardoffsets.h"
 #include "browsedatawidget.h"
 
 using namespace std;
@@ -368,59 +369,69 @@ void BrowseDataWidget::saveOffsets( void )
   if ( ( ! channelchanged ) && ( ! timechanged ) )
     return;
 
-  cout << "Read in '" << ConfigPath << "' ...\n";
-  ifstream sf( ConfigPath.c_str() );
-  deque< StrQueue > config;
-  string line = "";
-  StrQueue sq;
-  while ( true ) {
-    sq.clear();
-    sq.load( sf, "*", &line ).good();
-    config.push_back( sq );
-    if ( ! sf.good() )
-      break;
+  vector< int > offsets;
+  if ( timechanged )
+    offsets.assign( TimeOffset, TimeOffset+4 );
+  vector< int > channeloffsets;
+  if ( channelchanged )
+    channeloffsets.assign( TraceOffset, TraceOffset+MaxGrids );
+  cout << "Write out '" << ConfigPath << "' ...\n";
+  if ( BoardOffsets::saveOffsets( ConfigPath, offsets, channeloffsets ) < 0 )
+    printlog( "! error in BrowseDataWidget::saveOffsets() -> can not read " + ConfigPath );
+}
+
+
+void BrowseDataWidget::estimateOffsets( double time )
+{
+  // boards acquiring the channels of the grids:
+  vector< int > boardchannels;
+  int channels = 0;
+  for ( int board=0; board<4 && channels<Channels; board++ ) {
+    int nc = BoardChannels[board];
+    if ( channels + nc > Channels )
+      nc = Channels - channels;
+    boardchannels.push_back( nc );
+    channels += nc;
+  }
+  if ( boardchannels.size() < 2 ) {
+    cerr << "need at least two boards for estimating temporal offsets\n";
+    return;
   }
-  sf.close();
 
-  cout << "Write out '" << ConfigPath << "' ...\n";
-  ofstream df( ConfigPath.c_str() );
-  for ( unsigned int k=0; k<config.size(); k++ ) {
-    if ( config[k].empty() )
-      continue;
-    string title = config[k][0];
-    df << title << '\n';
-    config[k].erase( 0 );
-    // Fix empty and comma options (fo backwards compatibility):
-    for ( int i=0; i<config[k].size(); i++ ) {
-      int f = config[k][i].findFirstNot( Str::WhiteSpace );
-      int p = config[k][i].findLastNot( Str::WhiteSpace );
-      if ( f >= 4 && p > 0 && config[k][i][p] == ':' )
-	config[k][i] += " ~";
-      string val = config[k][i].value( 0, ":" );
-      if ( val.find( ',' ) != string::npos && val[0] != '"' ) {
-	config[k][i].erase( config[k][i].find( ':' ) );
-	config[k][i] += ": \"" + val + "\"";
-      }
-    }
-    Options opt( config[k] );
-    if ( channelchanged && config[k].size() > 0 && title == "*FishGrid" ) {
-      for ( int g=0; g<MaxGrids; g++ ) {
-	string ns = Str( g+1 );
-	if ( !opt.exist( "ChannelOffset"+ns ) )
-	  opt.insertInteger( "ChannelOffset"+ns, "ElectrodeType"+ns, 0 );
-	opt.setInteger( "ChannelOffset"+ns, TraceOffset[g] );
-      }
-    }
-    else if ( timechanged && config[k].size() > 0 && title == "*Acquisition" ) {
-      for ( int board=0; board<4; board++ ) {
-	string ns = Str( board+1 );
-	if ( !opt.exist( "offset"+ns ) )
-	  opt.insertInteger( "offset"+ns, "blacklist"+ns, 0 );
-	opt.setInteger( "offset"+ns, TimeOffset[board] );
+  // read data of all grids:
+  int scans = (int)::floor( time*SampleRate );
+  vector< float > data( (long long)scans*Channels );
+  int choffs = 0;
+  for ( int g=0; g<MaxGrids; g++ ) {
+    if ( Used[g] ) {
+      vector< float > buffer( (long long)scans*GridChannels[g] );
+      if ( ! TraceFile[g].good() )
+	TraceFile[g].clear();
+      TraceFile[g].seekg( (TraceIndex[g]+TraceOffset[g])*sizeof( float ) );
+      TraceFile[g].read( (char *)&buffer[0], buffer.size()*sizeof( float ) );
+      int n = TraceFile[g].gcount()/sizeof( float )/GridChannels[g];
+      if ( scans > n )
+	scans = n;
+      for ( int s=0; s<scans; s++ ) {
+	for ( int c=0; c<GridChannels[g]; c++ )
+	  data[(long long)s*Channels + choffs + c] = buffer[s*GridChannels[g] + c];
       }
+      choffs += GridChannels[g];
     }
-    opt.save( df, "  " );
-    df << '\n';
+  }
+  if ( scans < SampleRate ) {
+    cerr << "not enough data for estimating temporal offsets\n";
+    return;
+  }
+
+  BoardOffsets bo;
+  bo.setBoards( boardchannels );
+  bo.setMaxLag( (int)::floor( 0.005*SampleRate ) );
+  bo.estimate( &data[0], Channels, scans );
+  for ( int board=0; board<bo.boards(); board++ ) {
+    TimeOffset[board] = bo.offset( board );
+    cerr << "offset of board " << board+1 << ": " << TimeOffset[board]
+	 << " scans, correlation " << Str( bo.correlation( board ), "%.3f" ) << '\n';
   }
 }
 
@@ -611,6 +622,16 @@ void BrowseDataWidget::keyPressEvent( QKeyEvent *event )
     }
     break;
 
+  case Qt::Key_O :
+    if ( event->modifiers() & Qt::ControlModifier ) {
+      estimateOffsets();
+    }
+    else {
+      event->ignore();
+      return;
+    }
+    break;
+
   case Qt::Key_Greater :
     if ( event->modifiers() & Qt::ControlModifier ) {
       TimeOffset[1]++;
@@ -0,0 +1,334 @@
+/*
+  comedistream.cc
+  Drains the analog input data of a Comedi device into a staging buffer.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <relacs/str.h>
+#include "comedistream.h"
+
+using namespace relacs;
+
+
+ComediStream::ComediStream( void )
+  : Device( 0 ),
+    SubDevice( 0 ),
+    MapBuffer( 0 ),
+    MapSize( 0 ),
+    ScanSize( 1 ),
+    Rate( 1.0 ),
+    WakeSize( 1 ),
+    PollTimeout( 100000 ),
+    Policy( SCHED_OTHER ),
+    Priority( 0 ),
+    SchedulingError( "" ),
+    Stop( true ),
+    Error( 0 ),
+    Running( false ),
+    Transfers( 0 )
+{
+  Buffer.setMirrored( true );
+}
+
+
+ComediStream::~ComediStream( void )
+{
+  stopStream();
+}
+
+
+void ComediStream::setScheduling( int policy, int priority )
+{
+  Policy = policy;
+  Priority = priority;
+}
+
+
+int ComediStream::startStream( comedi_t *device, unsigned int subdevice,
+			       char *mapbuffer, int mapsize, int scansize, double rate,
+			       int wakesize, long long polltimeout, long long buffersize )
+{
+  stopStream();
+
+  if ( device == 0 || scansize < 1 || rate <= 0.0 )
+    return -1;
+  Device = device;
+  SubDevice = subdevice;
+  MapBuffer = mapbuffer;
+  MapSize = mapsize;
+  ScanSize = scansize;
+  Rate = rate;
+  // at least a single scan, and only whole scans:
+  WakeSize = ( ( wakesize + scansize - 1 ) / scansize ) * scansize;
+  if ( WakeSize < scansize )
+    WakeSize = scansize;
+  PollTimeout = polltimeout > 0 ? polltimeout : 100000;
+
+  // a multiple of whole scans:
+  if ( buffersize < 2*WakeSize )
+    buffersize = 2*WakeSize;
+  Buffer.clear();
+  Buffer.reserve( buffersize, scansize );
+  // no page faults on the first pass through the buffer:
+  Buffer.prefault();
+
+  Mutex.lock();
+  Stop = false;
+  Error = 0;
+  Running = true;
+  Transfers = 0;
+  SchedulingError = "";
+  Mutex.unlock();
+
+  QThread::start( HighestPriority );
+  // wait for the scheduling to be applied:
+  Scheduled.acquire();
+
+  return 0;
+}
+
+
+void ComediStream::stopStream( void )
+{
+  Mutex.lock();
+  Stop = true;
+  DataCondition.wakeAll();
+  Mutex.unlock();
+  if ( isRunning() )
+    QThread::wait();
+}
+
+
+bool ComediStream::streaming( void ) const
+{
+  Mutex.lock();
+  bool s = ( ! Stop && Running && Error == 0 );
+  Mutex.unlock();
+  return s;
+}
+
+
+const CyclicBuffer< char > &ComediStream::buffer( void ) const
+{
+  return Buffer;
+}
+
+
+bool ComediStream::waitForData( long long index, unsigned long time )
+{
+  Mutex.lock();
+  while ( Buffer.size() <= index && ! Stop && Running && Error == 0 ) {
+    if ( ! DataCondition.wait( &Mutex, time ) )
+      break;
+  }
+  bool data = ( Buffer.size() > index );
+  Mutex.unlock();
+  return data;
+}
+
+
+int ComediStream::error( void ) const
+{
+  Mutex.lock();
+  int e = Error;
+  Mutex.unlock();
+  return e;
+}
+
+
+bool ComediStream::running( void ) const
+{
+  Mutex.lock();
+  bool r = Running;
+  Mutex.unlock();
+  return r;
+}
+
+
+long long ComediStream::transfers( void ) const
+{
+  Mutex.lock();
+  long long n = Transfers;
+  Mutex.unlock();
+  return n;
+}
+
+
+string ComediStream::schedulingError( void ) const
+{
+  Mutex.lock();
+  string s = SchedulingError;
+  Mutex.unlock();
+  return s;
+}
+
+
+void ComediStream::setError( int ern )
+{
+  Mutex.lock();
+  if ( Error == 0 )
+    Error = ern;
+  DataCondition.wakeAll();
+  Mutex.unlock();
+}
+
+
+int ComediStream::transfer( int n )
+{
+  int offs = 0;
+  if ( MapBuffer != 0 ) {
+    offs = comedi_get_buffer_offset( Device, SubDevice );
+    if ( offs < 0 ) {
+      setError( errno );
+      return -1;
+    }
+  }
+  int k = 0;
+  while ( k < n ) {
+    int m = Buffer.maxPush();
+    if ( m > n - k )
+      m = n - k;
+    Buffer.claim( m );
+    char *dest = Buffer.pushBuffer();
+    if ( MapBuffer != 0 ) {
+      // comedi's buffer might wrap around:
+      int m1 = MapSize - offs;
+      if ( m1 > m )
+	m1 = m;
+      memcpy( dest, MapBuffer + offs, m1 );
+      if ( m > m1 )
+	memcpy( dest + m1, MapBuffer, m - m1 );
+      offs += m;
+      if ( offs >= MapSize )
+	offs -= MapSize;
+    }
+    else {
+      // the data are available, so the read returns immediately:
+      ssize_t r = ::read( comedi_fileno( Device ), dest, m );
+      if ( r < 0 ) {
+	int ern = errno;
+	if ( ern == EAGAIN || ern == EINTR )
+	  continue;
+	setError( ern );
+	return -1;
+      }
+      if ( r == 0 ) {
+	// end of data before the reported buffer contents were read:
+	setError( EIO );
+	return -1;
+      }
+      m = r;
+    }
+    Buffer.push( m, false );
+    k += m;
+  }
+  if ( MapBuffer != 0 && comedi_mark_buffer_read( Device, SubDevice, n ) < 0 ) {
+    setError( errno );
+    return -1;
+  }
+  Mutex.lock();
+  Buffer.publish();
+  Transfers++;
+  DataCondition.wakeAll();
+  Mutex.unlock();
+  return 0;
+}
+
+
+void ComediStream::run( void )
+{
+  // scheduling:
+  if ( Policy != SCHED_OTHER ) {
+    struct sched_param param;
+    param.sched_priority = Priority;
+    int r = pthread_setschedparam( pthread_self(), Policy, &param );
+    if ( r != 0 ) {
+      Mutex.lock();
+      SchedulingError = string( "priority " ) + Str( Priority ) + " denied: " + strerror( r );
+      Mutex.unlock();
+    }
+  }
+  Scheduled.release();
+
+  int fd = comedi_fileno( Device );
+  long long deadline = AcquisitionStats::microseconds() + PollTimeout;
+  while ( true ) {
+    Mutex.lock();
+    bool stop = Stop;
+    Mutex.unlock();
+    if ( stop )
+      break;
+
+    int n = comedi_get_buffer_contents( Device, SubDevice );
+    if ( n < 0 ) {
+      // comedi reports a buffer overflow by EPIPE:
+      setError( errno );
+      break;
+    }
+
+    // transfer the available whole scans:
+    long long now = AcquisitionStats::microseconds();
+    if ( n >= WakeSize || ( n >= ScanSize && now >= deadline ) ) {
+      if ( transfer( n - n % ScanSize ) < 0 )
+	break;
+      deadline = now + PollTimeout;
+      continue;
+    }
+
+    // no more data to be drained:
+    if ( n == 0 && ( comedi_get_subdevice_flags( Device, SubDevice ) & SDF_RUNNING ) == 0 ) {
+      Mutex.lock();
+      Running = false;
+      DataCondition.wakeAll();
+      Mutex.unlock();
+      break;
+    }
+
+    // time needed for the missing data in microseconds:
+    int missing = ( now < deadline ? WakeSize : ScanSize ) - n;
+    long long wait = (long long)::ceil( 1.0e6*missing/Rate );
+    if ( now < deadline && wait > deadline - now )
+      wait = deadline - now;
+    if ( wait > PollTimeout )
+      wait = PollTimeout;
+    if ( wait < 1 )
+      wait = 1;
+    if ( n == 0 ) {
+      // wake up as soon as there are some data:
+      struct pollfd fds;
+      fds.fd = fd;
+      fds.events = POLLIN;
+      fds.revents = 0;
+      int r = poll( &fds, 1, (int)( ( wait + 999 )/1000 ) );
+      if ( r < 0 && errno != EINTR ) {
+	setError( errno );
+	break;
+      }
+    }
+    else
+      usleep( wait );
+  }
+}
+
@@ -20,8 +20,12 @@
 */
 
 #include <cstring>
+#include <cerrno>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include "comedithread.h"
 
 
@@ -70,7 +74,11 @@ ComediThread::ComediThread( ConfigData *cd )
 {
   for ( int j=0; j<MaxDevices; j++ ) {
     addText( "device" + Str( j+1 ), "/dev/comedi" + Str( j ) );
+    addInteger( "offset" + Str( j+1 ), 0 );
     addText( "blacklist" + Str( j+1 ), "" );
+    MapBuffer[j] = 0;
+    MapSize[j] = 0;
+    WakeSize[j] = 0;
 #ifdef CALIBQTFIX
     addInteger( "caliborder" + Str( j+1 ), 1 );
     addNumber( "caliborigin" + Str( j+1 ), 0.0 );
@@ -81,6 +89,16 @@ ComediThread::ComediThread( ConfigData *cd )
 #endif
   }
   addSelection( "reference", "RSE|DIFF|RSE|NRSE" );
+  addSelection( "converter", "polynomial|polynomial|lookuptable" );
+  addBoolean( "mmapbuffer", false );
+  addBoolean( "pollwait", false );
+  addNumber( "wakeinterval", 0.01, "s" );
+  addNumber( "polltimeout", 0.1, "s" );
+  addBoolean( "pipeline", false );
+  addNumber( "stagingtime", 4.0, "s" );
+  PollTimeout = 0;
+  Pipeline = false;
+  WaitTime = 1000;
 }
 
 
@@ -121,6 +139,29 @@ void dump_cmd( comedi_cmd *cmd )
 }
 
 
+bool ComediThread::rawInputSupported( void )
+{
+  // raw counts need to fit into RawSample:
+  for ( int j=0; j<MaxDevices; j++ ) {
+    string devicefile = text( "device" + Str( j+1 ) );
+    if ( devicefile.empty() )
+      continue;
+    comedi_t *device = comedi_open( devicefile.c_str() );
+    if ( device == NULL )
+      continue;
+    int subdev = comedi_find_subdevice_by_type( device, COMEDI_SUBD_AI, 0 );
+    lsampl_t maxdata = subdev >= 0 ? comedi_get_maxdata( device, subdev, 0 ) : 0;
+    comedi_close( device );
+    if ( maxdata > 0xffff ) {
+      printlog( "! warning in ComediThread::rawInputSupported() -> samples of device "
+		+ devicefile + " exceed 16 bit, storing converted data instead of raw counts" );
+      return false;
+    }
+  }
+  return true;
+}
+
+
 int ComediThread::initialize( double duration )
 {
   printlog( "Number of channels needed: " + Str( channels() ) );
@@ -130,6 +171,9 @@ int ComediThread::initialize( double duration )
   int ref = index( "reference" );
   printlog( "Comedi reference: " + Str( ref ) + " (0=DIFF, 1=RSE, 2=NRSE)" );
 
+  // waiting for data:
+  PollTimeout = (long long)::ceil( 1.0e6*number( "polltimeout" ) );
+
   NDevices = 0;
   int grid = 0;
   while ( grid < maxGrids() && ! used(grid) )
@@ -198,6 +242,15 @@ int ComediThread::initialize( double duration )
       printlog( "! error: ComediThread::initialize() -> Setting nonblcoking mode failed on device"
 		+ devicefile );
     }
+#else
+    // waitForDevices() waits for the data, reads must not block:
+    if ( boolean( "pollwait" ) ) {
+      int fd = comedi_fileno( DeviceP[NDevices] );
+      if ( fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK ) < 0 ) {
+	printlog( "! error: ComediThread::initialize() -> Setting nonblcoking mode failed on device"
+		  + devicefile );
+      }
+    }
 #endif
 
     // set size of comedi-internal buffer to maximum:
@@ -752,7 +805,16 @@ int ComediThread::initialize( double duration )
     BufferSize[NDevices] = NChannels[NDevices] * (int)::ceil( 0.05 * sampleRate() )
       * BufferElemSize[NDevices];
     Buffer[NDevices] = new char[BufferSize[NDevices]];
-    NBuffer[NDevices] = 0;
+
+    // wake up as soon as this many bytes are available:
+    WakeSize[NDevices] = 1;
+    if ( boolean( "pollwait" ) )
+      WakeSize[NDevices] = (int)::ceil( number( "wakeinterval" ) * sampleRate() );
+    if ( WakeSize[NDevices] < 1 )
+      WakeSize[NDevices] = 1;
+    WakeSize[NDevices] *= NChannels[NDevices] * BufferElemSize[NDevices];
+    if ( WakeSize[NDevices] > BufferSize[NDevices] )
+      WakeSize[NDevices] = BufferSize[NDevices];
 
     // execute command:
     if ( masterscanbeginarg == 0 )
@@ -769,10 +831,31 @@ int ComediThread::initialize( double duration )
       Calib[NDevices] = 0;
       delete [] Buffer[NDevices];
       BufferSize[NDevices] = 0;
-      NBuffer[NDevices] = 0;
       continue;
     }
 
+    // map comedi's buffer for reading the data directly from it:
+    MapBuffer[NDevices] = 0;
+    MapSize[NDevices] = 0;
+    if ( boolean( "mmapbuffer" ) ) {
+      if ( comedi_get_read_subdevice( DeviceP[NDevices] ) == (int)SubDevice[NDevices] ) {
+	int size = comedi_get_buffer_size( DeviceP[NDevices], SubDevice[NDevices] );
+	void *map = mmap( NULL, size, PROT_READ, MAP_SHARED,
+			  comedi_fileno( DeviceP[NDevices] ), 0 );
+	if ( size > 0 && map != MAP_FAILED ) {
+	  MapBuffer[NDevices] = (char *)map;
+	  MapSize[NDevices] = size;
+	  printlog( "mapped " + Str( size ) + " bytes of comedi's buffer of " + devicefile );
+	}
+	else
+	  printlog( "! warning in ComediThread::initialize() -> mapping comedi's buffer of "
+		    + devicefile + " failed, using read() instead: " + strerror( errno ) );
+      }
+      else
+	printlog( "! warning in ComediThread::initialize() -> AI subdevice of "
+		  + devicefile + " is not the read subdevice, using read() instead" );
+    }
+
     NDevices++;
   }
 
@@ -797,12 +880,119 @@ int ComediThread::initialize( double duration )
   }
 #endif
 
-  DeviceInx = 0;
-  ChannelInx = 0;
+  // calibration of raw counts:
+  if ( rawInput() ) {
+    int gc[maxGrids()];
+    for ( int g=0; g<maxGrids(); g++ )
+      gc[g] = 0;
+    for ( int j=0; j<NDevices; j++ ) {
+      for ( int k=0; k<NChannels[j]; k++ ) {
+	int g = GridChannel[j][k];
+	double coeffs[4];
+	for ( unsigned int i=0; i<4; i++ )
+	  coeffs[i] = i <= Calib[j][k].order ? Calib[j][k].coefficients[i]/gain() : 0.0;
+	setCalibration( g, gc[g]++, 3, Calib[j][k].expansion_origin, coeffs );
+      }
+    }
+  }
+
+  // conversion of raw counts to voltages, with the gain folded in:
+  for ( int j=0; j<NDevices; j++ ) {
+    Converters[j].setChannels( NChannels[j] );
+    for ( int k=0; k<NChannels[j]; k++ ) {
+      int order = Calib[j][k].order < 3 ? Calib[j][k].order : 3;
+      double coeffs[4];
+      for ( int i=0; i<4; i++ )
+	coeffs[i] = i <= order ? Calib[j][k].coefficients[i] : 0.0;
+      Converters[j].setPolynomial( k, order, Calib[j][k].expansion_origin,
+				   coeffs, 1.0/gain() );
+    }
+    if ( ! rawInput() && index( "converter" ) == 1 ) {
+      if ( comedi_get_maxdata( DeviceP[j], SubDevice[j], 0 ) <= 0xffff ) {
+	Converters[j].setLookupTable();
+	printlog( "device " + Str( j ) + " converts raw counts by "
+		  + Str( Converters[j].tables() ) + " lookup tables" );
+      }
+      else
+	printlog( "! warning in ComediThread::initialize() -> samples of device " + Str( j )
+		  + " exceed 16 bit, converting them by polynomials" );
+    }
+    Converted[j].resize( rawInput() ? 0 : BufferSize[j]/BufferElemSize[j] );
+  }
+
+  // routing of the channels of the devices to the grids:
+  Plan.clear();
+  for ( int j=0; j<NDevices; j++ ) {
+    for ( int k=0; k<NChannels[j]; k++ )
+      Plan.add( j, GridChannel[j][k] );
+  }
+  for ( int g=0; g<maxGrids(); g++ ) {
+    if ( used( g ) && ( g >= Plan.grids() || Plan.gridChannels( g ) != gridChannels( g ) ) ) {
+      printlog( "! error in ComediThread::initialize() -> not enough channels for grid "
+		+ Str( g+1 ) );
+      return -1;
+    }
+  }
+  setBoards( Plan );
+  printlog( "routing the channels of " + Str( NDevices ) + " devices to the grids by "
+	    + Str( Plan.runs() ) + " runs" );
 
   cerr << "NDevices = " << NDevices << '\n';
 
-  return NDevices > 0 ? 0 : -1;
+  if ( NDevices <= 0 )
+    return -1;
+
+  // first stage of the pipeline:
+  Pipeline = boolean( "pipeline" );
+  if ( Pipeline && startStreams() < 0 )
+    return -1;
+
+  return 0;
+}
+
+
+int ComediThread::startStreams( void )
+{
+  // the drain threads run ahead of the acquisition thread:
+  int sched = index( "scheduler" );
+  int policy = SCHED_OTHER;
+  int priority = 0;
+  if ( sched > 0 ) {
+    policy = sched == 1 ? SCHED_FIFO : SCHED_RR;
+    priority = integer( "priority" ) + 1;
+    if ( priority < sched_get_priority_min( policy ) )
+      priority = sched_get_priority_min( policy );
+    else if ( priority > sched_get_priority_max( policy ) )
+      priority = sched_get_priority_max( policy );
+  }
+
+  WaitTime = (unsigned long)::ceil( 10.0*1000.0*number( "polltimeout" ) );
+  if ( WaitTime < 100 )
+    WaitTime = 100;
+  double stagingtime = number( "stagingtime" );
+  for ( int j=0; j<NDevices; j++ ) {
+    int scansize = NChannels[j]*BufferElemSize[j];
+    long long buffersize = (long long)::ceil( stagingtime*sampleRate() )*scansize;
+    Streams[j].setScheduling( policy, priority );
+    if ( Streams[j].startStream( DeviceP[j], SubDevice[j], MapBuffer[j], MapSize[j],
+				 scansize, scansize*sampleRate(), WakeSize[j],
+				 PollTimeout, buffersize ) < 0 ) {
+      printlog( "! error in ComediThread::initialize() -> starting the stream of device "
+		+ Str( j ) + " failed" );
+      for ( int k=0; k<j; k++ )
+	Streams[k].stopStream();
+      return -1;
+    }
+    Readers[j].attach( Streams[j].buffer(), 0 );
+    string se = Streams[j].schedulingError();
+    if ( ! se.empty() )
+      printlog( "! warning in ComediThread::initialize() -> scheduling of the stream of device "
+		+ Str( j ) + " with " + se );
+  }
+  printlog( "draining " + Str( NDevices ) + " devices into staging buffers of "
+	    + Str( Streams[0].buffer().capacity()/( NChannels[0]*BufferElemSize[0]*sampleRate() ), "%.1f" )
+	    + "s" );
+  return 0;
 }
 
 
@@ -812,6 +1002,12 @@ void ComediThread::finish( void )
     // stop acquisition:
     comedi_cancel( DeviceP[j], SubDevice[j] );
 
+    // stop draining:
+    if ( Pipeline ) {
+      Streams[j].stopStream();
+      Readers[j].detach();
+    }
+
     // clear buffers by reading:
     while ( comedi_get_buffer_contents( DeviceP[j], SubDevice[j] ) > 0 ) {
       char buffer[BufferSize[j]];
@@ -823,6 +1019,12 @@ void ComediThread::finish( void )
       comedi_cleanup_calibration( Calibration[j] );
     Calibration[j] = 0;
 
+    // unmap:
+    if ( MapBuffer[j] != 0 )
+      munmap( MapBuffer[j], MapSize[j] );
+    MapBuffer[j] = 0;
+    MapSize[j] = 0;
+
     // unlock:
     comedi_unlock( DeviceP[j],  SubDevice[j] );
 
@@ -837,140 +1039,350 @@ void ComediThread::finish( void )
     Calib[j] = 0;
     delete [] Buffer[j];
     BufferSize[j] = 0;
-    NBuffer[j] = 0;
     Samples[j] = 0;
     MaxSamples[j] = 0;
   }
+  Pipeline = false;
 
   // clear grids to keep buffers in shape:
   for ( int g=0; g < maxGrids(); g++ ) {
     if ( used(g) ) {
-      inputBuffer(g).resize( (inputBuffer(g).size()/gridChannels(g))
-			     * gridChannels(g) );
+      if ( rawInput() )
+	rawInputBuffer(g).resize( (rawInputBuffer(g).size()/gridChannels(g))
+				  * gridChannels(g) );
+      else
+	inputBuffer(g).resize( (inputBuffer(g).size()/gridChannels(g))
+			       * gridChannels(g) );
+    }
+  }
+}
+
+
+int ComediThread::waitForDevices( void )
+{
+  long long deadline = AcquisitionStats::microseconds() + PollTimeout;
+  while ( true ) {
+    struct pollfd fds[NDevices];
+    int nfds = 0;
+    long long wait = 0;
+    for ( int j=0; j<NDevices; j++ ) {
+      if ( MaxSamples[j] > 0 && Samples[j] >= MaxSamples[j] )
+	continue;
+      int n = comedi_get_buffer_contents( DeviceP[j], SubDevice[j] );
+      if ( n < 0 )
+	return 0;   // read() reports the error
+      if ( n >= WakeSize[j] )
+	continue;
+      // time needed for the missing data in microseconds:
+      long long w = (long long)::ceil( 1.0e6*( WakeSize[j] - n )
+				       /( NChannels[j]*BufferElemSize[j]*sampleRate() ) );
+      if ( w > wait )
+	wait = w;
+      // devices without data wake us up as soon as they get some:
+      if ( n == 0 ) {
+	fds[nfds].fd = comedi_fileno( DeviceP[j] );
+	fds[nfds].events = POLLIN;
+	fds[nfds].revents = 0;
+	nfds++;
+      }
+    }
+    // enough data on every device:
+    if ( wait <= 0 )
+      return 0;
+    long long now = AcquisitionStats::microseconds();
+    if ( now >= deadline )
+      return 0;
+    if ( wait > deadline - now )
+      wait = deadline - now;
+    int r = poll( fds, nfds, (int)( ( wait + 999 )/1000 ) );
+    if ( r < 0 && errno != EINTR ) {
+      int ern = errno;
+      printlog( "! error in ComediThread::waitForDevices() -> poll failed: "
+		+ Str( strerror( ern ) ) );
+      return -1;
+    }
+    for ( int k=0; k<nfds; k++ ) {
+      // read() reports the error of the device:
+      if ( ( fds[k].revents & ( POLLERR | POLLHUP | POLLNVAL ) ) != 0 )
+	return 0;
+    }
+    // stop waiting when the thread is asked to stop:
+    if ( ! running() )
+      return 0;
+  }
+}
+
+
+template < class S >
+void ComediThread::transferScans( int j, const S *source, int start, int from, int scans,
+				  float **fp, RawSample **rp )
+{
+  int nc = NChannels[j];
+  long long inx = start + (long long)from*nc;
+  long long n1 = (long long)scans*nc;
+  long long n2 = 0;
+  // comedi's buffer, if data are taken directly from it, might wrap around:
+  long long ring = MapBuffer[j] != 0 ? MapSize[j] / BufferElemSize[j] : 0;
+  if ( ring > 0 ) {
+    if ( inx >= ring )
+      inx -= ring;
+    if ( inx + n1 > ring ) {
+      n2 = inx + n1 - ring;
+      n1 = ring - inx;
     }
   }
+  transferStaged( Plan, j, scans, source + inx, n1, source, n2, Converters[j],
+		  rawInput() ? 0 : &Converted[j][0], fp, rp );
 }
 
 
 int ComediThread::read( void )
 {
-  lsampl_t *lbuffer[NDevices];
-  sampl_t *sbuffer[NDevices];
-  int readn[NDevices];
-  int bufferinx[NDevices];
-  bool ready = true;
+  if ( Pipeline )
+    return readStreams();
+
+  // sleep until enough data are available:
+  if ( waitForDevices() < 0 )
+    return -1;
 
+  // number of whole scans available on all devices:
+  int scans = -1;
+  bool ready = true;
   for ( int j=0; j<NDevices; j++ ) {
     // check:
-    if ( MaxSamples[j] > 0 && Samples[j] >= MaxSamples[j] )
+    if ( MaxSamples[j] > 0 && Samples[j] >= MaxSamples[j] ) {
+      scans = 0;
       continue;
+    }
     ready = false;
 
-    // initialize pointers:
-    lbuffer[j] = (lsampl_t *)Buffer[j];
-    sbuffer[j] = (sampl_t *)Buffer[j];
-    readn[j] = 0;   // XXX This was missing! (10.5.2014)
-    bufferinx[j] = 0;
-
-    // get data from daq driver:
-    //    cerr << "READ " << BufferSize[j]-NBuffer[j] << '\n';
-    ssize_t m = ::read( comedi_fileno( DeviceP[j] ),
-			&Buffer[j][NBuffer[j]], BufferSize[j]-NBuffer[j] );
+    int m = comedi_get_buffer_contents( DeviceP[j], SubDevice[j] );
     int ern = errno;
-    //    cerr << "READ j=" << j << " m=" << m << " ern=" << ern << " NBuffer[j]=" << NBuffer[j] << " bufferinx[j]=" << bufferinx[j] << " readn[j]=" << readn[j] << '\n';
-    if ( m < 0 && ern != EAGAIN && ern != EINTR ) {
+    if ( m < 0 ) {
+      // comedi reports a buffer overflow by EPIPE:
+      if ( ern == EPIPE )
+	countOverrun();
       printlog( "ComediThread::read(): error on device " + Str( j )
-		+ " -> " + Str( errno ) + ": " + Str( strerror( ern ) ) );
+		+ " -> " + Str( ern ) + ": " + Str( strerror( ern ) ) );
       return -1;
     }
 
     // no more data to be read:
-    if ( m <= 0 && ( comedi_get_subdevice_flags( DeviceP[j], SubDevice[j] )
+    if ( m == 0 && ( comedi_get_subdevice_flags( DeviceP[j], SubDevice[j] )
 		     & SDF_RUNNING ) == 0 ) {
       printlog( "! error in ComediThread::read(): no data and not running on device " + Str( j ) );
       return -1;
     }
 
-    // number of read samples:
-    if ( m > 0 ) {
-      NBuffer[j] += m;
-      readn[j] = NBuffer[j] / BufferElemSize[j];
-      Samples[j] += m / BufferElemSize[j];
-      //      cerr << "UPDATE READ DATA j=" << j << " NBuffer[j]=" << NBuffer[j] << " readn[j]=" << readn[j] << " m=" << m << '\n';
-    }
+    int scansize = NChannels[j]*BufferElemSize[j];
+    int n = m / scansize;
+    if ( n > BufferSize[j] / scansize )
+      n = BufferSize[j] / scansize;
+    if ( MaxSamples[j] > 0 && n > ( MaxSamples[j] - Samples[j] ) / NChannels[j] )
+      n = ( MaxSamples[j] - Samples[j] ) / NChannels[j];
+    if ( scans < 0 || n < scans )
+      scans = n;
   }
 
   // nothing read anymore:
   if ( ready )
     return 1;
+  if ( scans <= 0 )
+    return 0;
 
-  // transfer data to input buffer:
-  bool data = true;
-  do {
-    int pn[maxGrids()];
-    int mp[maxGrids()];
-    float *fp[maxGrids()];
-    for ( int g=0; g<maxGrids(); g++ ) {
-      if ( used( g ) ) {
-	pn[g] = 0;
-	mp[g] = inputBuffer( g ).maxPush();
-	fp[g] = inputBuffer( g ).pushBuffer();
+  // get the data of the devices:
+  int mapinx[MaxDevices];
+  for ( int j=0; j<NDevices; j++ ) {
+    mapinx[j] = 0;
+    if ( MapBuffer[j] != 0 ) {
+      // data are directly accessed in comedi's buffer:
+      mapinx[j] = comedi_get_buffer_offset( DeviceP[j], SubDevice[j] ) / BufferElemSize[j];
+      continue;
+    }
+    // the data are available, so the reads return immediately:
+    int nbytes = scans*NChannels[j]*BufferElemSize[j];
+    int n = 0;
+    while ( n < nbytes ) {
+      ssize_t m = ::read( comedi_fileno( DeviceP[j] ), &Buffer[j][n], nbytes-n );
+      int ern = errno;
+      if ( m < 0 && ern != EAGAIN && ern != EINTR ) {
+	// comedi reports a buffer overflow by EPIPE:
+	if ( ern == EPIPE )
+	  countOverrun();
+	printlog( "ComediThread::read(): error on device " + Str( j )
+		  + " -> " + Str( ern ) + ": " + Str( strerror( ern ) ) );
+	return -1;
       }
-      else
-	mp[g] = -1;
+      if ( m == 0 ) {
+	printlog( "! error in ComediThread::read() -> no more data on device " + Str( j ) );
+	return -1;
+      }
+      if ( m > 0 )
+	n += m;
     }
-    //    cerr << "TRANSFER DeviceInx=" << DeviceInx << " bufferinx[DeviceInx]=" << bufferinx[DeviceInx] << " readn[DeviceInx]=" << readn[DeviceInx] << '\n';
-    while ( bufferinx[DeviceInx] < readn[DeviceInx] ) {
-      int g = GridChannel[DeviceInx][ChannelInx];
-      if ( mp[g] <= 0 )
-	break;
-      lsampl_t v;
-      if ( LongSampleType[DeviceInx] )
-	v = lbuffer[DeviceInx][bufferinx[DeviceInx]];
+  }
+
+  // transfer whole scans to the input buffers:
+  int k = 0;
+  while ( k < scans ) {
+    float *fp[maxGrids()];
+    RawSample *rp[maxGrids()];
+    int n = claimScans( scans - k, fp, rp );
+    if ( n <= 0 ) {
+      printlog( "! error in ComediThread::read() -> no space for a whole scan in the input buffers" );
+      return -1;
+    }
+    for ( int j=0; j<NDevices; j++ ) {
+      char *buffer = MapBuffer[j] != 0 ? MapBuffer[j] : Buffer[j];
+      if ( LongSampleType[j] )
+	transferScans( j, (lsampl_t *)buffer, mapinx[j], k, n, fp, rp );
       else
-	v = sbuffer[DeviceInx][bufferinx[DeviceInx]];
-      *(fp[g]++) = comedi_to_physical( v, &Calib[DeviceInx][ChannelInx] )/gain();
-      //      cerr << "convert " << v << " to " << *(fp[g]-1) << '\n';
-      bufferinx[DeviceInx]++;
-      pn[g]++;
-      mp[g]--;
-      ChannelInx++;
-      if ( ChannelInx >= NChannels[DeviceInx] ) {
-	ChannelInx = 0;
-	DeviceInx++;
-	if ( DeviceInx >= NDevices )
-	  DeviceInx = 0;
-      }
+	transferScans( j, (sampl_t *)buffer, mapinx[j], k, n, fp, rp );
     }
-    for ( int g=0; g<maxGrids(); g++ ) {
-      if ( used( g ) ) {
-	lockAI( g );
-	// cerr << "PUSHED " << pn[g] << " on grid " << g << '\n';
-	inputBuffer( g ).push( pn[g] );
-	unlockAI( g );
-      }
+    pushScans( n );
+    k += n;
+  }
+
+  // release the transfered data:
+  for ( int j=0; j<NDevices; j++ ) {
+    if ( MapBuffer[j] != 0 )
+      comedi_mark_buffer_read( DeviceP[j], SubDevice[j],
+			       scans*NChannels[j]*BufferElemSize[j] );
+    Samples[j] += scans*NChannels[j];
+  }
+
+  return 0;
+}
+
+
+
+template < class S >
+void ComediThread::transferStream( int j, int from, int scans, float **fp, RawSample **rp )
+{
+  int nc = NChannels[j];
+  int es = sizeof( S );
+  long long inx = Readers[j].readIndex() + (long long)from*nc*es;
+  const char *b1;
+  const char *b2;
+  long long m1, m2;
+  Streams[j].buffer().spans( inx, inx + (long long)scans*nc*es, b1, m1, b2, m2 );
+  // the capacity of the staging buffer is a multiple of the scan size:
+  transferStaged( Plan, j, scans, (const S *)b1, m1 / es, (const S *)b2, m2 / es,
+		  Converters[j], rawInput() ? 0 : &Converted[j][0], fp, rp );
+}
+
+
+int ComediThread::readStreams( void )
+{
+  // wait for data of all devices:
+  bool ready = true;
+  for ( int j=0; j<NDevices; j++ ) {
+    if ( MaxSamples[j] > 0 && Samples[j] >= MaxSamples[j] )
+      continue;
+    ready = false;
+
+    // at least a single scan:
+    int scansize = NChannels[j]*BufferElemSize[j];
+    Streams[j].waitForData( Readers[j].readIndex() + scansize - 1, WaitTime );
+
+    int ern = Streams[j].error();
+    if ( ern != 0 ) {
+      // comedi reports a buffer overflow by EPIPE:
+      if ( ern == EPIPE )
+	countOverrun();
+      printlog( "ComediThread::read(): error on device " + Str( j )
+		+ " -> " + Str( ern ) + ": " + Str( strerror( ern ) ) );
+      return -1;
     }
-    for ( int k=0; k<NDevices; k++ ) {
-      if ( bufferinx[k] >= readn[k] ) {
-	data = false;
-	break;
-      }
+
+    // no more data to be read:
+    if ( ! Streams[j].running() && Readers[j].readSize() < scansize ) {
+      printlog( "! error in ComediThread::read(): no data and not running on device " + Str( j ) );
+      return -1;
     }
-  } while ( data );
+  }
+
+  // nothing read anymore:
+  if ( ready )
+    return 1;
 
-  // keep not transfered data:
+  // data lost in the staging buffers, all devices skip the same scans:
+  int scansizes[MaxDevices];
+  for ( int j=0; j<NDevices; j++ )
+    scansizes[j] = NChannels[j]*BufferElemSize[j];
+  long long lost = recoverScans( Readers, scansizes, NDevices );
+  if ( lost > 0 ) {
+    countOverrun();
+    for ( int j=0; j<NDevices; j++ )
+      Samples[j] += lost*NChannels[j];
+    printlog( "! error in ComediThread::read() -> lost " + Str( (long)lost )
+	      + " scans in the staging buffers" );
+  }
+
+  // number of whole scans available on all devices:
+  int scans = -1;
+  long long minscans = -1;
+  long long maxscans = -1;
   for ( int j=0; j<NDevices; j++ ) {
-    //    cerr << " j=" << j << " bufferinx[j]=" << bufferinx[j] << " readn[j]=" << readn[j] << " NBuffer[j]=" << NBuffer[j] << '\n';
-    if ( bufferinx[j] < readn[j] ) {
-      if ( bufferinx[j] > 0 ) {
-	int binx = bufferinx[j]*BufferElemSize[j];
-	//	cerr << "MEMMOVE binx=" << binx << " j=" << j << " NBuffer[j]=" << NBuffer[j] << " BufferSize[j]=" << BufferSize[j] << " NBuffer[j]-binx=" << NBuffer[j]-binx << '\n';
-	memmove( &Buffer[j][0], &Buffer[j][binx], NBuffer[j]-binx );
-	NBuffer[j] -= binx;
-      }
+    if ( MaxSamples[j] > 0 && Samples[j] >= MaxSamples[j] ) {
+      scans = 0;
+      continue;
     }
-    else
-      NBuffer[j] = 0;
+    long long n = Readers[j].readSize() / scansizes[j];
+    if ( minscans < 0 || n < minscans )
+      minscans = n;
+    if ( n > maxscans )
+      maxscans = n;
+    if ( ! rawInput() && n > (long long)Converted[j].size() / NChannels[j] )
+      n = Converted[j].size() / NChannels[j];
+    if ( MaxSamples[j] > 0 && n > ( MaxSamples[j] - Samples[j] ) / NChannels[j] )
+      n = ( MaxSamples[j] - Samples[j] ) / NChannels[j];
+    if ( scans < 0 || n < scans )
+      scans = n;
+  }
+  // scans some devices are ahead of the others:
+  if ( NDevices > 1 && minscans >= 0 )
+    countSkew( maxscans - minscans );
+  if ( scans <= 0 )
+    return 0;
+
+  // transfer whole scans to the input buffers:
+  int k = 0;
+  while ( k < scans ) {
+    float *fp[maxGrids()];
+    RawSample *rp[maxGrids()];
+    int n = claimScans( scans - k, fp, rp );
+    if ( n <= 0 ) {
+      printlog( "! error in ComediThread::read() -> no space for a whole scan in the input buffers" );
+      return -1;
+    }
+    bool valid = true;
+    for ( int j=0; j<NDevices; j++ ) {
+      if ( LongSampleType[j] )
+	transferStream< lsampl_t >( j, k, n, fp, rp );
+      else
+	transferStream< sampl_t >( j, k, n, fp, rp );
+      // the stream might have overwritten the data while they were transferred:
+      long long from = Readers[j].readIndex() + (long long)k*scansizes[j];
+      if ( Readers[j].validate( from, from + (long long)n*scansizes[j], scansizes[j] ) > 0 )
+	valid = false;
+    }
+    if ( ! valid ) {
+      // drop these scans on all devices, the next read() recovers:
+      countOverrun();
+      printlog( "! error in ComediThread::read() -> dropped " + Str( n )
+		+ " scans that were overwritten in the staging buffers" );
+      scans = k + n;
+      break;
+    }
+    pushScans( n );
+    k += n;
+  }
+
+  // release the transfered data:
+  for ( int j=0; j<NDevices; j++ ) {
+    Readers[j].read( (long long)scans*scansizes[j] );
+    Samples[j] += scans*NChannels[j];
   }
 
   return 0;
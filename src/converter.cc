@@ -0,0 +1,133 @@
+/*
+  converter.cc
+  Conversion of raw ADC counts to physical units.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "converter.h"
+
+
+Converter::Converter( void )
+  : Order( 1 )
+{
+}
+
+
+Converter::Converter( int channels )
+  : Order( 1 )
+{
+  setChannels( channels );
+}
+
+
+int Converter::channels( void ) const
+{
+  return Origin.size();
+}
+
+
+void Converter::setChannels( int channels )
+{
+  Origin.assign( channels, 0.0F );
+  Coefficients[0].assign( channels, 0.0F );
+  Coefficients[1].assign( channels, 1.0F );
+  Coefficients[2].assign( channels, 0.0F );
+  Coefficients[3].assign( channels, 0.0F );
+  Order = 1;
+  clearLookupTable();
+}
+
+
+void Converter::setPolynomial( int c, int order, double origin, const double *coeffs,
+			       double scale )
+{
+  if ( c < 0 || c >= channels() )
+    return;
+  clearLookupTable();
+  Origin[c] = origin;
+  for ( int k=0; k<4; k++ )
+    Coefficients[k][c] = k <= order ? scale*coeffs[k] : 0.0;
+  // highest order of all polynomials:
+  Order = 1;
+  for ( int k=3; k>1 && Order <= 1; k-- ) {
+    for ( int i=0; i<channels(); i++ ) {
+      if ( Coefficients[k][i] != 0.0F ) {
+	Order = k;
+	break;
+      }
+    }
+  }
+}
+
+
+int Converter::order( void ) const
+{
+  return Order;
+}
+
+
+void Converter::setLookupTable( void )
+{
+  clearLookupTable();
+  TableOffset.resize( channels() );
+  for ( int c=0; c<channels(); c++ ) {
+    // share the table of a previous channel with the same polynomial:
+    int p = 0;
+    for ( ; p<c; p++ ) {
+      if ( Origin[p] == Origin[c] &&
+	   Coefficients[0][p] == Coefficients[0][c] &&
+	   Coefficients[1][p] == Coefficients[1][c] &&
+	   Coefficients[2][p] == Coefficients[2][c] &&
+	   Coefficients[3][p] == Coefficients[3][c] )
+	break;
+    }
+    if ( p < c ) {
+      TableOffset[c] = TableOffset[p];
+      continue;
+    }
+    // new table, evaluated in double precision:
+    TableOffset[c] = Tables.size();
+    Tables.resize( Tables.size() + TableSize );
+    float *table = &Tables[TableOffset[c]];
+    for ( int x=0; x<TableSize; x++ ) {
+      double d = x - (double)Origin[c];
+      table[x] = Coefficients[0][c] + d*( Coefficients[1][c]
+		 + d*( Coefficients[2][c] + d*(double)Coefficients[3][c] ) );
+    }
+  }
+}
+
+
+void Converter::clearLookupTable( void )
+{
+  Tables.clear();
+  TableOffset.clear();
+}
+
+
+bool Converter::lookupTable( void ) const
+{
+  return ! Tables.empty();
+}
+
+
+int Converter::tables( void ) const
+{
+  return Tables.size() / TableSize;
+}
+
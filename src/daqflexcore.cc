@@ -236,6 +236,55 @@ int DAQFlexCore::reset( void )
 }
 
 
+int DAQFlexCore::productID( int mccdevicenum )
+{
+  if ( libusb_init( NULL ) != 0 )
+    return 0;
+  libusb_device **list;
+  ssize_t listsize = libusb_get_device_list( NULL, &list );
+  int productid = 0;
+  int mccdevicecount = 0;
+  for ( int i=0; i<listsize && productid == 0; i++ ) {
+    libusb_device_descriptor desc;
+    libusb_get_device_descriptor( list[i], &desc );
+    if ( desc.idVendor == MCCVendorID ) {
+      mccdevicecount++;
+      if ( mccdevicenum == mccdevicecount )
+	productid = desc.idProduct;
+    }
+  }
+  if ( listsize >= 0 )
+    libusb_free_device_list( list, true );
+  return productid;
+}
+
+
+unsigned int DAQFlexCore::maxAIData( int productid )
+{
+  switch ( productid ) {
+  case USB_1608_G:
+  case USB_1608_GX:
+  case USB_1608_GX_2AO:
+  case USB_7202:
+  case USB_1608_FS_Plus:
+    return 0xFFFF;
+  case USB_201:
+  case USB_202:
+  case USB_204:
+  case USB_205:
+  case USB_7204:
+  case USB_1208_FS_Plus:
+  case USB_1408_FS_Plus:
+    return 0x0FFF;
+  case USB_2408:
+  case USB_2408_2AO:
+    return 0xFFFFFF;
+  default:
+    return 0;
+  }
+}
+
+
 unsigned int DAQFlexCore::maxAIData( void ) const
 {
   return MaxAIData;
@@ -523,7 +572,7 @@ int DAQFlexCore::initDevice( const string &path )
   case USB_1608_G:
   case USB_1608_GX:
   case USB_1608_GX_2AO:
-    MaxAIData = 0xFFFF;
+    MaxAIData = maxAIData( ProductID );
     if ( ProductID == USB_1608_G )
       MaxAIRate = 250000.0;
     else
@@ -554,7 +603,7 @@ int DAQFlexCore::initDevice( const string &path )
     break;
 
   case USB_201:
-    MaxAIData = 0x0FFF;
+    MaxAIData = maxAIData( ProductID );
     MaxAIRate = 100000.0;
     MaxAIChannels = 8;
     AIFIFOSize = 12288;
@@ -566,7 +615,7 @@ int DAQFlexCore::initDevice( const string &path )
     break;
 
   case USB_202:
-    MaxAIData = 0x0FFF;
+    MaxAIData = maxAIData( ProductID );
     MaxAIRate = 100000.0;
     MaxAIChannels = 8;
     AIFIFOSize = 12288;
@@ -578,7 +627,7 @@ int DAQFlexCore::initDevice( const string &path )
     break;
 
   case USB_204:
-    MaxAIData = 0x0FFF;
+    MaxAIData = maxAIData( ProductID );
     MaxAIRate = 500000.0;
     MaxAIChannels = 8;
     AIFIFOSize = 12288;
@@ -590,7 +639,7 @@ int DAQFlexCore::initDevice( const string &path )
     break;
 
   case USB_205:
-    MaxAIData = 0x0FFF;
+    MaxAIData = maxAIData( ProductID );
     MaxAIRate = 500000.0;
     MaxAIChannels = 8;
     AIFIFOSize = 12288;
@@ -602,7 +651,7 @@ int DAQFlexCore::initDevice( const string &path )
     break;
 
   case USB_7202:
-    MaxAIData = 0xFFFF;
+    MaxAIData = maxAIData( ProductID );
     MaxAIRate = 50000.0;
     MaxAIChannels = 8;
     AIFIFOSize = 32768;
@@ -614,7 +663,7 @@ int DAQFlexCore::initDevice( const string &path )
     break;
 
   case USB_7204:
-    MaxAIData = 0xFFF;
+    MaxAIData = maxAIData( ProductID );
     MaxAIRate = 50000.0;
     MaxAIChannels = 8;
     AIFIFOSize = 32768;
@@ -626,7 +675,7 @@ int DAQFlexCore::initDevice( const string &path )
     break;
 
   case USB_1208_FS_Plus:
-    MaxAIData = 0xFFF;
+    MaxAIData = maxAIData( ProductID );
     MaxAIRate = 50000.0;
     MaxAIChannels = 8;
     AIFIFOSize = 0; // ???
@@ -641,7 +690,7 @@ int DAQFlexCore::initDevice( const string &path )
     break;
 
   case USB_1408_FS_Plus:
-    MaxAIData = 0xFFF;
+    MaxAIData = maxAIData( ProductID );
     MaxAIRate = 48000.0;
     MaxAIChannels = 8;
     AIFIFOSize = 0; // ???
@@ -653,7 +702,7 @@ int DAQFlexCore::initDevice( const string &path )
     break;
 
   case USB_1608_FS_Plus:
-    MaxAIData = 0xFFFF;
+    MaxAIData = maxAIData( ProductID );
     MaxAIRate = 400000.0;
     MaxAIChannels = 8;
     AIFIFOSize = 32768;
@@ -665,7 +714,7 @@ int DAQFlexCore::initDevice( const string &path )
     break;
 
   case USB_2408:
-    MaxAIData = 0xFFFFFF;
+    MaxAIData = maxAIData( ProductID );
     MaxAIRate = 1000.0;
     MaxAIChannels = 16;
     AIFIFOSize = 32768;
@@ -677,7 +726,7 @@ int DAQFlexCore::initDevice( const string &path )
     break;
 
   case USB_2408_2AO:
-    MaxAIData = 0xFFFFFF;
+    MaxAIData = maxAIData( ProductID );
     MaxAIRate = 1000.0;
     MaxAIChannels = 16;
     AIFIFOSize = 32768;
@@ -0,0 +1,367 @@
+/*
+  daqflexstream.cc
+  Asynchronous streaming of analog input data from a DAQFlex device.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <sys/time.h>
+#include "daqflexstream.h"
+
+
+DAQFlexStream::DAQFlexStream( void )
+  : Device( 0 ),
+    Pending( 0 ),
+    Stop( true ),
+    Error( DAQFlexCore::Success ),
+    Completed( 0 ),
+    Short( 0 ),
+    Overrun( false ),
+    StatusInterval( 1000000 ),
+    CheckStatus( false ),
+    StatusChecks( 0 ),
+    StatusTime( 0 )
+{
+  Buffer.setMirrored( true );
+}
+
+
+DAQFlexStream::~DAQFlexStream( void )
+{
+  stopStream();
+}
+
+
+int DAQFlexStream::startStream( DAQFlexCore *device, int transfers, int transfersize,
+				long long buffersize )
+{
+  stopStream();
+
+  Device = device;
+  if ( Device == 0 || ! Device->isOpen() || transfers < 1 || transfersize < 1 )
+    return DAQFlexCore::ErrorLibUSBInvalidParam;
+
+  // transfers of whole packets:
+  int inps = Device->inPacketSize();
+  if ( inps < 2 )
+    inps = 2;
+  transfersize = ( ( transfersize + inps - 1 ) / inps ) * inps;
+
+  // the buffer holds at least twice the samples in flight:
+  if ( buffersize < (long long)transfers*transfersize )
+    buffersize = (long long)transfers*transfersize;
+  Buffer.clear();
+  Buffer.reserve( buffersize );
+
+  Mutex.lock();
+  Stop = false;
+  Error = DAQFlexCore::Success;
+  Completed = 0;
+  Short = 0;
+  Overrun = false;
+  CheckStatus = false;
+  StatusChecks = 0;
+  StatusTime = 0;
+  Pending = 0;
+  Mutex.unlock();
+
+  // submit the transfers:
+  TransferData.resize( (long)transfers*transfersize );
+  Transfers.resize( transfers, 0 );
+  for ( int k=0; k<transfers; k++ ) {
+    Transfers[k] = libusb_alloc_transfer( 0 );
+    if ( Transfers[k] == 0 ) {
+      stopStream();
+      return DAQFlexCore::ErrorLibUSBNoMem;
+    }
+    libusb_fill_bulk_transfer( Transfers[k], Device->deviceHandle(), Device->endpointIn(),
+			       &TransferData[(long)k*transfersize], transfersize,
+			       callback, this, 0 );
+    Mutex.lock();
+    int r = libusb_submit_transfer( Transfers[k] );
+    if ( r == 0 )
+      Pending++;
+    Mutex.unlock();
+    if ( r != 0 ) {
+      stopStream();
+      return DAQFlexCore::getLibUSBError( r );
+    }
+  }
+
+  // handle the transfers:
+  QThread::start( HighestPriority );
+
+  return DAQFlexCore::Success;
+}
+
+
+void DAQFlexStream::stopStream( void )
+{
+  Mutex.lock();
+  Stop = true;
+  DataCondition.wakeAll();
+  Mutex.unlock();
+
+  // the callbacks do not resubmit anymore, cancel the pending transfers:
+  for ( unsigned int k=0; k<Transfers.size(); k++ ) {
+    if ( Transfers[k] != 0 )
+      libusb_cancel_transfer( Transfers[k] );
+  }
+
+  // the event loop finishes when all transfers are returned:
+  if ( isRunning() )
+    QThread::wait();
+  else {
+    // transfers submitted without event loop:
+    while ( true ) {
+      Mutex.lock();
+      bool done = ( Pending <= 0 );
+      Mutex.unlock();
+      if ( done )
+	break;
+      struct timeval tv = { 0, 100000 };
+      libusb_handle_events_timeout_completed( NULL, &tv, NULL );
+    }
+  }
+
+  freeTransfers();
+}
+
+
+bool DAQFlexStream::streaming( void ) const
+{
+  Mutex.lock();
+  bool s = ( ! Stop && Pending > 0 );
+  Mutex.unlock();
+  return s;
+}
+
+
+void DAQFlexStream::setStatusInterval( long long interval )
+{
+  Mutex.lock();
+  StatusInterval = interval;
+  Mutex.unlock();
+}
+
+
+long long DAQFlexStream::statusInterval( void ) const
+{
+  Mutex.lock();
+  long long interval = StatusInterval;
+  Mutex.unlock();
+  return interval;
+}
+
+
+const CyclicBuffer< unsigned short > &DAQFlexStream::buffer( void ) const
+{
+  return Buffer;
+}
+
+
+bool DAQFlexStream::waitForData( long long index, unsigned long time )
+{
+  Mutex.lock();
+  while ( Buffer.size() <= index && ! Stop && ! Overrun &&
+	  Error == DAQFlexCore::Success ) {
+    if ( ! DataCondition.wait( &Mutex, time ) )
+      break;
+  }
+  bool data = ( Buffer.size() > index );
+  Mutex.unlock();
+  return data;
+}
+
+
+DAQFlexCore::DAQFlexError DAQFlexStream::error( void ) const
+{
+  Mutex.lock();
+  DAQFlexCore::DAQFlexError e = Error;
+  Mutex.unlock();
+  return e;
+}
+
+
+long long DAQFlexStream::transfers( void ) const
+{
+  Mutex.lock();
+  long long n = Completed;
+  Mutex.unlock();
+  return n;
+}
+
+
+long long DAQFlexStream::shortTransfers( void ) const
+{
+  Mutex.lock();
+  long long n = Short;
+  Mutex.unlock();
+  return n;
+}
+
+
+bool DAQFlexStream::overrun( void ) const
+{
+  Mutex.lock();
+  bool o = Overrun;
+  Mutex.unlock();
+  return o;
+}
+
+
+long long DAQFlexStream::statusChecks( void ) const
+{
+  Mutex.lock();
+  long long n = StatusChecks;
+  Mutex.unlock();
+  return n;
+}
+
+
+long long DAQFlexStream::statusTime( void ) const
+{
+  Mutex.lock();
+  long long t = StatusTime;
+  Mutex.unlock();
+  return t;
+}
+
+
+void DAQFlexStream::run( void )
+{
+  long long lastcheck = AcquisitionStats::microseconds();
+  while ( true ) {
+    Mutex.lock();
+    bool done = ( Pending <= 0 );
+    bool check = ( ! Stop && ! Overrun &&
+		   ( CheckStatus ||
+		     ( StatusInterval > 0 &&
+		       AcquisitionStats::microseconds() - lastcheck >= StatusInterval ) ) );
+    CheckStatus = false;
+    Mutex.unlock();
+    if ( done )
+      break;
+    if ( check ) {
+      checkStatus();
+      lastcheck = AcquisitionStats::microseconds();
+    }
+    struct timeval tv = { 0, 100000 };
+    libusb_handle_events_timeout_completed( NULL, &tv, NULL );
+  }
+}
+
+
+void DAQFlexStream::checkStatus( void )
+{
+  long long t0 = AcquisitionStats::microseconds();
+  string status = Device->sendMessage( "?AISCAN:STATUS" );
+  long long t1 = AcquisitionStats::microseconds();
+  Mutex.lock();
+  StatusChecks++;
+  StatusTime += t1 - t0;
+  if ( status == "AISCAN:STATUS=OVERRUN" ) {
+    Overrun = true;
+    DataCondition.wakeAll();
+  }
+  Mutex.unlock();
+}
+
+
+void LIBUSB_CALL DAQFlexStream::callback( libusb_transfer *transfer )
+{
+  ((DAQFlexStream *)transfer->user_data)->transferred( transfer );
+}
+
+
+void DAQFlexStream::transferred( libusb_transfer *transfer )
+{
+  DAQFlexCore::DAQFlexError error = DAQFlexCore::Success;
+  switch ( transfer->status ) {
+  case LIBUSB_TRANSFER_COMPLETED: {
+    // copy the samples into the buffer:
+    const unsigned short *data = (const unsigned short *)transfer->buffer;
+    int n = transfer->actual_length / 2;
+    int k = 0;
+    while ( k < n ) {
+      int m = Buffer.maxPush();
+      if ( m > n - k )
+	m = n - k;
+      Buffer.claim( m );
+      memcpy( Buffer.pushBuffer(), data + k, m*sizeof( unsigned short ) );
+      Buffer.push( m, false );
+      k += m;
+    }
+    Buffer.publish();
+    break;
+  }
+  case LIBUSB_TRANSFER_CANCELLED:
+    break;
+  case LIBUSB_TRANSFER_TIMED_OUT:
+    error = DAQFlexCore::ErrorLibUSBTimeout;
+    break;
+  case LIBUSB_TRANSFER_STALL:
+    error = DAQFlexCore::ErrorLibUSBPipe;
+    break;
+  case LIBUSB_TRANSFER_NO_DEVICE:
+    error = DAQFlexCore::ErrorLibUSBNoDevice;
+    break;
+  case LIBUSB_TRANSFER_OVERFLOW:
+    error = DAQFlexCore::ErrorLibUSBOverflow;
+    break;
+  default:
+    error = DAQFlexCore::ErrorTransferFailed;
+  }
+
+  Mutex.lock();
+  if ( transfer->status == LIBUSB_TRANSFER_COMPLETED ) {
+    Completed++;
+    if ( transfer->actual_length < transfer->length ) {
+      // the device might have stopped the scan:
+      Short++;
+      CheckStatus = true;
+    }
+  }
+  if ( error != DAQFlexCore::Success && Error == DAQFlexCore::Success )
+    Error = error;
+  // resubmit right away to keep the transfers in flight:
+  if ( ! Stop && Error == DAQFlexCore::Success &&
+       transfer->status == LIBUSB_TRANSFER_COMPLETED ) {
+    int r = libusb_submit_transfer( transfer );
+    if ( r != 0 ) {
+      Error = DAQFlexCore::getLibUSBError( r );
+      Pending--;
+    }
+  }
+  else
+    Pending--;
+  DataCondition.wakeAll();
+  Mutex.unlock();
+}
+
+
+void DAQFlexStream::freeTransfers( void )
+{
+  for ( unsigned int k=0; k<Transfers.size(); k++ ) {
+    if ( Transfers[k] != 0 )
+      libusb_free_transfer( Transfers[k] );
+  }
+  Transfers.clear();
+  TransferData.clear();
+}
+
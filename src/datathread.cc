@@ -19,42 +19,189 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include "datathread.h"
 
 
 DataThread::DataThread( const string &name, ConfigData *cd )
   : ConfigClass( name ),
+    Raw( false ),
+    BlockSamples( 0 ),
+    NotifyGrid( 0 ),
+    NotifyScans( 1 ),
+    NotifyFill( 0 ),
+    Notifications( 0 ),
+    StatsTime( 0 ),
+    StatsInterval( 0 ),
+    Started( false ),
+    SchedPolicy( SCHED_OTHER ),
+    SchedPriority( 0 ),
+    SchedCPUs( "" ),
+    MemoryLocked( false ),
+    Run( false ),
+    EndOfData( false ),
     CD( cd ),
     Error( false )
 {
+  for ( int g=0; g<ConfigData::MaxGrids; g++ )
+    BlockFill[g] = 0;
+  addBoolean( "rawbuffer", false );
+  addInteger( "blocksamples", 0 );
+  addBoolean( "mirroredbuffer", true );
+  addSelection( "bufferhugepages", "transparent|none|transparent|explicit" );
+  addBoolean( "lockbuffers", true );
+  addBoolean( "prefaultbuffers", true );
+  addInteger( "notifyscans", 0 );
+  addNumber( "notifytime", 0.1, "s" );
+  addNumber( "statsinterval", 60.0, "s" );
+  addSelection( "scheduler", "other|other|fifo|rr" );
+  addInteger( "priority", 50 );
+  addText( "cpu", "" );
+  addBoolean( "lockmemory", false );
 }
 
 
 int DataThread::start( double duration )
 {
-  // analog input buffers:
-  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
-    if ( used( g ) ) {
-      int nbuffer = (int)::floor( sampleRate()*bufferTime()*gridChannels( g ) );
-      AIBuffer[g].reserve( nbuffer );
-      printlog( "buffer size of grid " + Str( g+1 ) +
-		" is " + Str( AIBuffer[g].capacity() ) );
-    }
+  // a previous run() might not have returned yet after its final notify(),
+  // then QThread::start() would not start a new one:
+  if ( isRunning() )
+    wait();
+
+  // calibration of raw data, identity by default:
+  for ( int g=0; g<ConfigData::MaxGrids; g++ )
+    Calibration[g].setChannels( used( g ) ? gridChannels( g ) : 0 );
+
+  // analog input buffers, their mode is kept on a restart,
+  // because consumers may still be attached to them:
+  if ( ! Started ) {
+    Raw = boolean( "rawbuffer" ) && rawInputSupported();
+    BlockSamples = integer( "blocksamples" );
+    if ( BlockSamples < 0 )
+      BlockSamples = 0;
   }
+  allocateBuffers();
+
+  // notification of consumers:
+  NotifyGrid = 0;
+  for ( int g=ConfigData::MaxGrids-1; g>=0; g-- ) {
+    if ( used( g ) )
+      NotifyGrid = g;
+  }
+  NotifyScans = integer( "notifyscans" );
+  if ( NotifyScans <= 0 )
+    NotifyScans = (int)::ceil( number( "notifytime" )*sampleRate() );
+  if ( NotifyScans < 1 )
+    NotifyScans = 1;
+  NotifyFill = 0;
+
+  // clock stamps for at least one read per millisecond,
+  // on a restart they continue like the input buffers,
+  // since a Recording might still follow them:
+  long long nclocks = (long long)::ceil( 1000.0*bufferTime() );
+  Clocks.reserve( nclocks < 4096 ? 4096 : nclocks );
+
+  // statistics:
+  StatsMutex.lock();
+  if ( Started )
+    Stats.addRestart();
+  else
+    Stats.clear( AcquisitionStats::microseconds() );
+  Started = true;
+  StatsTime = AcquisitionStats::microseconds();
+  StatsInterval = (long long)::rint( 1.0e6*number( "statsinterval" ) );
+  StatsMutex.unlock();
 
   RunMutex.lock();
   Run = true;
+  EndOfData = false;
   RunMutex.unlock();
   
   int r = initialize( duration );
 
-  if ( r == 0 )
+  if ( r == 0 ) {
+    // lock all current and future memory of the process:
+    if ( boolean( "lockmemory" ) && ! MemoryLocked ) {
+      if ( mlockall( MCL_CURRENT | MCL_FUTURE ) != 0 )
+	printlog( "! warning in DataThread::start() -> locking the memory failed: "
+		  + string( strerror( errno ) ) );
+      else {
+	MemoryLocked = true;
+	printlog( "locked the memory of the process" );
+      }
+    }
     QThread::start( HighestPriority );
+    // wait for the scheduling to be applied:
+    Scheduled.acquire();
+  }
   
   return r;
 }
 
 
+template < class T >
+void DataThread::allocateBuffer( CyclicBuffer< T > &buffer, int g, long long n )
+{
+  buffer.setMirrored( boolean( "mirroredbuffer" ) );
+  buffer.setHugePages( index( "bufferhugepages" ) );
+  buffer.reserve( n, blockSize( g ) );
+  printlog( "buffer size of grid " + Str( g+1 ) +
+	    " is " + Str( (long)buffer.capacity() ) +
+	    ( Raw ? " raw samples" : "" ) +
+	    ( buffer.mirrored() ? " (mirrored)" : "" ) );
+  if ( boolean( "mirroredbuffer" ) && ! buffer.mirrored() )
+    printlog( "! warning in DataThread::start() -> mirrored mapping of the buffer of grid "
+	      + Str( g+1 ) + " failed, using heap memory" );
+  if ( buffer.hugePages() != index( "bufferhugepages" ) )
+    printlog( "! warning in DataThread::start() -> requested huge pages for the buffer of grid "
+	      + Str( g+1 ) + " not available" );
+  // map all pages now and not in the acquisition thread:
+  if ( boolean( "prefaultbuffers" ) )
+    buffer.prefault();
+  if ( boolean( "lockbuffers" ) ) {
+    int r = buffer.lock();
+    if ( r != 0 )
+      printlog( "! warning in DataThread::start() -> locking the buffer of grid "
+		+ Str( g+1 ) + " failed: " + strerror( r ) );
+    else
+      printlog( "locked " + Str( buffer.lockedSize()/1024.0/1024.0, "%.1f" )
+		+ " MB of the buffer of grid " + Str( g+1 ) + " into memory" );
+  }
+}
+
+
+void DataThread::allocateBuffers( void )
+{
+  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
+    if ( used( g ) ) {
+      long long nbuffer = (long long)::floor( sampleRate()*bufferTime()*gridChannels( g ) );
+      // whole number of blocks:
+      long long nblock = blockSize( g );
+      nbuffer = ( ( nbuffer + nblock - 1 ) / nblock ) * nblock;
+      // block that is filled by the implementation:
+      BlockFill[g] = 0;
+      // release the memory of the buffer that is not used:
+      if ( Raw ) {
+	if ( AIBuffer[g].capacity() > 0 )
+	  AIBuffer[g] = CyclicBuffer< float >();
+	allocateBuffer( AIRawBuffer[g], g, nbuffer );
+      }
+      else {
+	if ( AIRawBuffer[g].capacity() > 0 )
+	  AIRawBuffer[g] = CyclicBuffer< RawSample >();
+	allocateBuffer( AIBuffer[g], g, nbuffer );
+      }
+    }
+  }
+}
+
+
 void DataThread::stop( void )
 {
   RunMutex.lock();
@@ -78,6 +225,15 @@ bool DataThread::running( void ) const
 }
 
 
+bool DataThread::endOfData( void ) const
+{
+  RunMutex.lock();
+  bool eod = EndOfData;
+  RunMutex.unlock();
+  return eod;
+}
+
+
 int DataThread::maxGrids( void ) const
 {
   return CD->MaxGrids;
@@ -144,27 +300,504 @@ void DataThread::unlockAI( int g )
 }
 
 
+bool DataThread::rawInput( void ) const
+{
+  return Raw;
+}
+
+
+const CyclicBufferBase &DataThread::inputRing( int g ) const
+{
+  if ( Raw )
+    return AIRawBuffer[g];
+  else
+    return AIBuffer[g];
+}
+
+
+long long DataThread::convert( int g, long long from, long long upto, float *data ) const
+{
+  if ( ! Raw ) {
+    const float *d[2];
+    long long n[2];
+    int ns = AIBuffer[g].spans( from, upto, d[0], n[0], d[1], n[1] );
+    if ( ns < 0 )
+      return ns;
+    for ( int s=0; s<ns; s++ ) {
+      memcpy( data, d[s], n[s]*sizeof( float ) );
+      data += n[s];
+    }
+    return AIBuffer[g].validIndex() > from ? -5 : upto - from;
+  }
+
+  const RawSample *d[2];
+  long long n[2];
+  int ns = AIRawBuffer[g].spans( from, upto, d[0], n[0], d[1], n[1] );
+  if ( ns < 0 )
+    return ns;
+  const Converter &cv = Calibration[g];
+  int nc = cv.channels();
+  if ( BlockSamples <= 0 ) {
+    // the channel changes after every data element:
+    int c = from % nc;
+    for ( int s=0; s<ns; s++ ) {
+      cv.convert( d[s], data, n[s], c );
+      data += n[s];
+      c = ( c + n[s] ) % nc;
+    }
+    return AIRawBuffer[g].validIndex() > from ? -5 : upto - from;
+  }
+  // the channel changes after BlockSamples data elements:
+  int c = ( from % ( BlockSamples*nc ) ) / BlockSamples;
+  int t = from % BlockSamples;
+  for ( int s=0; s<ns; s++ ) {
+    for ( long long k=0; k<n[s]; ) {
+      long long m = BlockSamples - t;
+      if ( m > n[s] - k )
+	m = n[s] - k;
+      cv.convertChannel( d[s]+k, data, m, c );
+      data += m;
+      k += m;
+      t += m;
+      if ( t >= BlockSamples ) {
+	t = 0;
+	if ( ++c >= nc )
+	  c = 0;
+      }
+    }
+  }
+  return AIRawBuffer[g].validIndex() > from ? -5 : upto - from;
+}
+
+
+int DataThread::blockSamples( void ) const
+{
+  return BlockSamples;
+}
+
+
+int DataThread::blockSize( int g ) const
+{
+  return BlockSamples > 0 ? BlockSamples*gridChannels( g ) : gridChannels( g );
+}
+
+
+bool DataThread::rawInputSupported( void )
+{
+  return true;
+}
+
+
+void DataThread::setCalibration( int g, int c, int order, double origin, const double *coeffs )
+{
+  Calibration[g].setPolynomial( c, order, origin, coeffs );
+}
+
+
+int DataThread::maxPush( int g ) const
+{
+  int m = Raw ? AIRawBuffer[g].maxPush() : AIBuffer[g].maxPush();
+  if ( BlockSamples <= 0 )
+    return m;
+  // the capacity is a multiple of blocks or the buffer is mirrored,
+  // so a whole block is always contiguous:
+  int n = blockSize( g ) - BlockFill[g];
+  if ( BlockFill[g] == 0 && m < n )
+    return 0;
+  return n;
+}
+
+
+float *DataThread::pushBuffer( int g, int n )
+{
+  if ( BlockSamples <= 0 ) {
+    AIBuffer[g].claim( n );
+    return AIBuffer[g].pushBuffer();
+  }
+  // claim the whole block when it is started:
+  if ( BlockFill[g] == 0 )
+    AIBuffer[g].claim( blockSize( g ) );
+  return AIBuffer[g].pushBuffer() + BlockFill[g]/gridChannels( g );
+}
+
+
+DataThread::RawSample *DataThread::rawPushBuffer( int g, int n )
+{
+  if ( BlockSamples <= 0 ) {
+    AIRawBuffer[g].claim( n );
+    return AIRawBuffer[g].pushBuffer();
+  }
+  // claim the whole block when it is started:
+  if ( BlockFill[g] == 0 )
+    AIRawBuffer[g].claim( blockSize( g ) );
+  return AIRawBuffer[g].pushBuffer() + BlockFill[g]/gridChannels( g );
+}
+
+
+int DataThread::scanStride( int g ) const
+{
+  return BlockSamples > 0 ? 1 : gridChannels( g );
+}
+
+
+int DataThread::channelStride( void ) const
+{
+  return BlockSamples > 0 ? BlockSamples : 1;
+}
+
+
+void DataThread::push( int g, int n )
+{
+  if ( BlockSamples <= 0 ) {
+    if ( Raw )
+      AIRawBuffer[g].push( n );
+    else
+      AIBuffer[g].push( n );
+    if ( g == NotifyGrid )
+      NotifyFill += n;
+    return;
+  }
+
+  BlockFill[g] += n;
+  if ( BlockFill[g] >= blockSize( g ) ) {
+    // publish the complete block at once:
+    if ( Raw )
+      AIRawBuffer[g].push( blockSize( g ) );
+    else
+      AIBuffer[g].push( blockSize( g ) );
+    BlockFill[g] = 0;
+    if ( g == NotifyGrid )
+      NotifyFill += blockSize( g );
+  }
+}
+
+
+int DataThread::claimScans( int scans, float **fp, RawSample **rp )
+{
+  int n = scans;
+  for ( int g=0; g<maxGrids(); g++ ) {
+    if ( used( g ) ) {
+      int m = maxPush( g ) / gridChannels( g );
+      if ( n > m )
+	n = m;
+    }
+  }
+  if ( n <= 0 )
+    return 0;
+  for ( int g=0; g<maxGrids(); g++ ) {
+    if ( used( g ) ) {
+      if ( Raw )
+	rp[g] = rawPushBuffer( g, n*gridChannels( g ) );
+      else
+	fp[g] = pushBuffer( g, n*gridChannels( g ) );
+    }
+  }
+  return n;
+}
+
+
+void DataThread::pushScans( int scans )
+{
+  for ( int g=0; g<maxGrids(); g++ ) {
+    if ( used( g ) )
+      push( g, scans*gridChannels( g ) );
+  }
+}
+
+
+void DataThread::notify( bool force )
+{
+  if ( ! force && NotifyFill < (long long)NotifyScans*gridChannels( NotifyGrid ) )
+    return;
+  NotifyFill = 0;
+  NotifyMutex.lock();
+  Notifications++;
+  NotifyCondition.wakeAll();
+  NotifyMutex.unlock();
+  emit dataAvailable();
+}
+
+
+int DataThread::notifyScans( void ) const
+{
+  return NotifyScans;
+}
+
+
+unsigned long DataThread::notifications( void ) const
+{
+  NotifyMutex.lock();
+  unsigned long n = Notifications;
+  NotifyMutex.unlock();
+  return n;
+}
+
+
+const CyclicBuffer< DataThread::ClockStamp > &DataThread::clockStamps( void ) const
+{
+  return Clocks;
+}
+
+
+int DataThread::boards( void ) const
+{
+  return BoardChannels.size();
+}
+
+
+int DataThread::boardChannels( int b ) const
+{
+  return BoardChannels[b];
+}
+
+
+void DataThread::setBoards( DemuxPlan &plan )
+{
+  plan.setBlockSamples( BlockSamples );
+  // a scan wrapping around a buffer, allocated before acquisition:
+  int maxchannels = 0;
+  for ( int d=0; d<plan.devices(); d++ ) {
+    if ( plan.channels( d ) > maxchannels )
+      maxchannels = plan.channels( d );
+  }
+  WrappedScan.resize( maxchannels );
+  BoardChannels.resize( plan.devices() );
+  for ( int d=0; d<plan.devices(); d++ )
+    BoardChannels[d] = plan.channels( d );
+}
+
+
+long long DataThread::recoverScans( CyclicBufferReader *readers,
+				    const int *scansizes, int n )
+{
+  long long skip = 0;
+  for ( int j=0; j<n; j++ ) {
+    long long m = readers[j].buffer().minIndex() - readers[j].readIndex();
+    if ( m > 0 ) {
+      m = ( m + scansizes[j] - 1 ) / scansizes[j];
+      if ( m > skip )
+	skip = m;
+    }
+  }
+  if ( skip > 0 ) {
+    for ( int j=0; j<n; j++ )
+      readers[j].seek( readers[j].readIndex() + skip*scansizes[j] );
+  }
+  return skip;
+}
+
+
+void DataThread::stampClocks( void )
+{
+  struct timespec mt;
+  struct timespec rt;
+  clock_gettime( CLOCK_MONOTONIC, &mt );
+  clock_gettime( CLOCK_REALTIME, &rt );
+  ClockStamp cs;
+  cs.Index = inputRing( NotifyGrid ).size()/gridChannels( NotifyGrid );
+  cs.Monotonic = (long long)mt.tv_sec*1000000000LL + mt.tv_nsec;
+  cs.Realtime = (long long)rt.tv_sec*1000000000LL + rt.tv_nsec;
+  Clocks.push( cs );
+}
+
+
+AcquisitionStats DataThread::stats( void ) const
+{
+  StatsMutex.lock();
+  AcquisitionStats s( Stats );
+  StatsMutex.unlock();
+  return s;
+}
+
+
+void DataThread::statsOptions( Options &opts ) const
+{
+  stats().options( opts, AcquisitionStats::microseconds() );
+}
+
+
+void DataThread::reportLag( int g, long long lag )
+{
+  int nc = gridChannels( g );
+  long long capacity = inputRing( g ).capacity();
+  StatsMutex.lock();
+  Stats.addLag( g, lag/nc, capacity/nc );
+  StatsMutex.unlock();
+}
+
+
+void DataThread::countOverrun( void )
+{
+  StatsMutex.lock();
+  Stats.addOverrun();
+  StatsMutex.unlock();
+}
+
+
+void DataThread::countStatusChecks( long long checks, long long time )
+{
+  StatsMutex.lock();
+  Stats.addStatusChecks( checks, time );
+  StatsMutex.unlock();
+}
+
+
+void DataThread::countSkew( long long scans )
+{
+  StatsMutex.lock();
+  Stats.addSkew( scans );
+  StatsMutex.unlock();
+}
+
+
+void DataThread::logStats( void )
+{
+  Options opts;
+  statsOptions( opts );
+  ostringstream ss;
+  opts.save( ss, "  " );
+  CD->printlog( "acquisition statistics:\n" + ss.str() );
+}
+
+
+bool DataThread::waitForData( unsigned long &count, unsigned long time )
+{
+  NotifyMutex.lock();
+  if ( count == Notifications )
+    NotifyCondition.wait( &NotifyMutex, time );
+  bool r = ( count != Notifications );
+  count = Notifications;
+  NotifyMutex.unlock();
+  return r;
+}
+
+
 double DataThread::bufferTime( void ) const
 {
   return CD->BufferTime;
 }
 
 
+void DataThread::applyScheduling( void )
+{
+  // real-time scheduling:
+  int sched = index( "scheduler" );
+  if ( sched > 0 ) {
+    int policy = sched == 1 ? SCHED_FIFO : SCHED_RR;
+    string name = sched == 1 ? "SCHED_FIFO" : "SCHED_RR";
+    struct sched_param param;
+    param.sched_priority = integer( "priority" );
+    if ( param.sched_priority < sched_get_priority_min( policy ) )
+      param.sched_priority = sched_get_priority_min( policy );
+    else if ( param.sched_priority > sched_get_priority_max( policy ) )
+      param.sched_priority = sched_get_priority_max( policy );
+    int r = pthread_setschedparam( pthread_self(), policy, &param );
+    if ( r != 0 )
+      printlog( "! warning in DataThread::run() -> request for " + name + " scheduling with priority "
+		+ Str( param.sched_priority ) + " denied: " + strerror( r ) );
+  }
+
+  // CPU affinity:
+  Str cpus = text( "cpu" );
+  if ( ! cpus.empty() ) {
+    vector< int > cpulist;
+    cpus.range( cpulist, ",", "-" );
+    cpu_set_t cpuset;
+    CPU_ZERO( &cpuset );
+    for ( unsigned int k=0; k<cpulist.size(); k++ ) {
+      if ( cpulist[k] >= 0 && cpulist[k] < CPU_SETSIZE )
+	CPU_SET( cpulist[k], &cpuset );
+    }
+    int r = pthread_setaffinity_np( pthread_self(), sizeof( cpuset ), &cpuset );
+    if ( r != 0 )
+      printlog( "! warning in DataThread::run() -> request for running on CPUs "
+		+ cpus + " denied: " + strerror( r ) );
+  }
+
+  // what we got:
+  int policy = SCHED_OTHER;
+  struct sched_param param;
+  param.sched_priority = 0;
+  pthread_getschedparam( pthread_self(), &policy, &param );
+  string cpulist = "";
+  cpu_set_t cpuset;
+  CPU_ZERO( &cpuset );
+  if ( pthread_getaffinity_np( pthread_self(), sizeof( cpuset ), &cpuset ) == 0 ) {
+    for ( int k=0; k<CPU_SETSIZE; k++ ) {
+      if ( CPU_ISSET( k, &cpuset ) ) {
+	if ( ! cpulist.empty() )
+	  cpulist += ",";
+	cpulist += Str( k );
+      }
+    }
+  }
+  StatsMutex.lock();
+  SchedPolicy = policy;
+  SchedPriority = param.sched_priority;
+  SchedCPUs = cpulist;
+  StatsMutex.unlock();
+  Options opts;
+  schedulingOptions( opts );
+  ostringstream ss;
+  opts.save( ss, "  " );
+  CD->printlog( "acquisition thread scheduling:\n" + ss.str() );
+}
+
+
+void DataThread::schedulingOptions( Options &opts ) const
+{
+  StatsMutex.lock();
+  string policy = "SCHED_OTHER";
+  if ( SchedPolicy == SCHED_FIFO )
+    policy = "SCHED_FIFO";
+  else if ( SchedPolicy == SCHED_RR )
+    policy = "SCHED_RR";
+  opts.addText( "Scheduler", policy );
+  opts.addInteger( "Priority", SchedPriority );
+  opts.addText( "CPUs", SchedCPUs );
+  opts.addBoolean( "LockedMemory", MemoryLocked );
+  StatsMutex.unlock();
+}
+
+
 void DataThread::run( void )
 {
+  applyScheduling();
+  Scheduled.release();
+
   int r = 0;
   bool rd = true;
 
   do {
+    long long t0 = AcquisitionStats::microseconds();
+    long long n0 = NotifyFill;
     r = read();
+    long long t1 = AcquisitionStats::microseconds();
+    if ( NotifyFill != n0 )
+      stampClocks();
+    bool logstats = false;
+    StatsMutex.lock();
+    Stats.addRead( t1 - t0, ( NotifyFill - n0 )/gridChannels( NotifyGrid ) );
+    if ( StatsInterval > 0 && t1 - StatsTime >= StatsInterval ) {
+      StatsTime = t1;
+      logstats = true;
+    }
+    StatsMutex.unlock();
+    notify();
+    if ( logstats )
+      logStats();
     RunMutex.lock();
     rd = Run;
     RunMutex.unlock();
   } while ( rd && r == 0 );
   RunMutex.lock();
   Run = false;
+  EndOfData = ( r > 0 );
   RunMutex.unlock();
   finish();
+  // wake up the consumers, whether the thread was stopped or failed,
+  // they might wait for data or for the end of the acquisition:
+  notify( true );
 }
 
 
@@ -186,3 +819,7 @@ void DataThread::clearError( void )
   Error = false;
 }
 
+
+
+#include "moc_datathread.cc"
+
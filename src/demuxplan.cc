@@ -0,0 +1,117 @@
+/*
+  demuxplan.cc
+  Precompiled routing of multiplexed device scans to the grids.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "demuxplan.h"
+
+
+DemuxPlan::DemuxPlan( void )
+  : BlockSamples( 0 )
+{
+}
+
+
+void DemuxPlan::clear( void )
+{
+  Runs.clear();
+  Channels.clear();
+  GridChannels.clear();
+}
+
+
+void DemuxPlan::add( int device, int grid )
+{
+  if ( device < 0 || grid < 0 )
+    return;
+  if ( device >= (int)Runs.size() ) {
+    Runs.resize( device+1 );
+    Channels.resize( device+1, 0 );
+  }
+  if ( grid >= (int)GridChannels.size() )
+    GridChannels.resize( grid+1, 0 );
+  vector< Run > &runs = Runs[device];
+  if ( ! runs.empty() &&
+       runs.back().Grid == grid &&
+       runs.back().Source + runs.back().Count == Channels[device] &&
+       runs.back().Dest + runs.back().Count == GridChannels[grid] )
+    runs.back().Count++;
+  else {
+    Run run;
+    run.Source = Channels[device];
+    run.Grid = grid;
+    run.Dest = GridChannels[grid];
+    run.Count = 1;
+    runs.push_back( run );
+  }
+  Channels[device]++;
+  GridChannels[grid]++;
+}
+
+
+int DemuxPlan::devices( void ) const
+{
+  return Runs.size();
+}
+
+
+int DemuxPlan::channels( int device ) const
+{
+  return Channels[device];
+}
+
+
+int DemuxPlan::grids( void ) const
+{
+  return GridChannels.size();
+}
+
+
+int DemuxPlan::gridChannels( int grid ) const
+{
+  return GridChannels[grid];
+}
+
+
+int DemuxPlan::runs( int device ) const
+{
+  return Runs[device].size();
+}
+
+
+int DemuxPlan::runs( void ) const
+{
+  int n = 0;
+  for ( unsigned int d=0; d<Runs.size(); d++ )
+    n += Runs[d].size();
+  return n;
+}
+
+
+void DemuxPlan::setBlockSamples( int samples )
+{
+  BlockSamples = samples > 0 ? samples : 0;
+}
+
+
+int DemuxPlan::blockSamples( void ) const
+{
+  return BlockSamples;
+}
+
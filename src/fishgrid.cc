@@ -36,7 +36,7 @@ void usage( void )
   cout << "\n";
   cout << "Usage:\n";
   cout << "\n";
-  cout << "FishGrid -f SAMPLINGRATE -g GAIN -v MAXVOLT -b BUFFERTIME -d DATATIME -n -s -t TIME -m -3 DATAFILE\n";
+  cout << "FishGrid -f SAMPLINGRATE -g GAIN -v MAXVOLT -b BUFFERTIME -d DATATIME -n -s -t TIME -m -3 -r RECORDING DATAFILE\n";
   cout << "\n";
   cout << "-f SAMPLINGRATE     sampling rate in hertz for each channel\n";
   cout << "-g GAIN             gain factor of the amplifiers\n";
@@ -49,6 +49,7 @@ void usage( void )
   cout << "-t TIME             stop saving and quit at time TIME in hh:mm:ss format\n";
   cout << "-m                  open with maximized window\n";
   cout << "-3                  simulation (dry) mode\n";
+  cout << "-r RECORDING        acquire data by replaying the recording in directory RECORDING\n";
   cout << "DATAFILE            browse the existing data file (raw data, config file, or path)\n";
   exit( 0 );
 }
@@ -67,6 +68,7 @@ int main( int argc, char **argv )
   bool saving = false;
   string stoptime = "";
   bool simulate = false;
+  string replay = "";
 
   static struct option longoptions[] = {
     { "version", 0, 0, 0 },
@@ -77,7 +79,7 @@ int main( int argc, char **argv )
   opterr = 0;
   int longindex = 0;
   char c;
-  while ( (c = getopt_long( argc, argv, "f:g:v:b:d:p:t:mns3", longoptions, &longindex )) >= 0 ) {
+  while ( (c = getopt_long( argc, argv, "f:g:v:b:d:p:t:r:mns3", longoptions, &longindex )) >= 0 ) {
     switch ( c ) {
     case 0: switch ( longindex ) {
       case 0:
@@ -150,6 +152,11 @@ int main( int argc, char **argv )
 	stoptime = optarg;
       break;
 
+    case 'r':
+      if ( optarg != NULL )
+	replay = optarg;
+      break;
+
     case 'm':
       maximize = true;
       break;
@@ -188,7 +195,7 @@ int main( int argc, char **argv )
     QApplication app( argc, argv );
     FishGridWidget fishgrid( samplerate, maxvolts, gain,
 			     buffertime, datatime, datainterval,
-			     dialog, saving, stoptime, simulate );
+			     dialog, saving, stoptime, simulate, replay );
     if ( maximize )
       fishgrid.showMaximized();
     fishgrid.show();
@@ -0,0 +1,175 @@
+/*
+  fishgridbenchconvert.cc
+  Benchmark for the conversion of raw ADC counts to voltages.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <getopt.h>
+#include <time.h>
+#include "converter.h"
+
+using namespace std;
+
+
+/*
+  The default configuration resembles an NI PCI-6259 as used for the
+  fish grids: 32 single-ended channels sampled with 16 bit at 20kHz
+  in a single +-10V range. Comedi's softcal polynomials for the
+  M-series boards are of third order and depend on the range only,
+  so all channels share a single polynomial.
+*/
+
+
+double seconds( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + 1.0e-9*ts.tv_nsec;
+}
+
+
+void usage( void )
+{
+  cout << "usage:\n";
+  cout << "\n";
+  cout << "fishgridbenchconvert [-c xxx] [-r xxx] [-t xxx] [-p xxx] [-o xxx] [-g xxx]\n";
+  cout << "\n";
+  cout << "-c : the number of channels (default 32)\n";
+  cout << "-r : the sampling rate per channel in Hz (default 20000)\n";
+  cout << "-t : the duration of simulated data in seconds (default 60)\n";
+  cout << "-p : the number of distinct calibration polynomials (default 1)\n";
+  cout << "-o : the order of the calibration polynomials (default 3)\n";
+  cout << "-g : the gain of the amplifiers (default 1)\n";
+  exit( 0 );
+}
+
+
+/*
+  Convert the raw counts \a data in chunks of \a chunk data elements
+  as ComediThread::read() does and return the time needed in seconds.
+*/
+double benchmark( const Converter &cv, const vector< unsigned short > &data,
+		  int chunk, long long n, vector< float > &out )
+{
+  int nc = cv.channels();
+  long long nd = data.size();
+  double t0 = seconds();
+  long long k = 0;
+  while ( k < n ) {
+    long long inx = k % nd;
+    int m = chunk;
+    if ( m > nd - inx )
+      m = nd - inx;
+    if ( m > n - k )
+      m = n - k;
+    cv.convert( &data[inx], &out[0], m, inx % nc );
+    k += m;
+  }
+  return seconds() - t0;
+}
+
+
+int main( int argc, char **argv )
+{
+  int channels = 32;
+  double samplerate = 20000.0;
+  double duration = 60.0;
+  int polynomials = 1;
+  int order = 3;
+  double gain = 1.0;
+
+  int c;
+  while ( (c = getopt( argc, argv, "c:r:t:p:o:g:h" )) >= 0 ) {
+    switch ( c ) {
+    case 'c': channels = atoi( optarg ); break;
+    case 'r': samplerate = atof( optarg ); break;
+    case 't': duration = atof( optarg ); break;
+    case 'p': polynomials = atoi( optarg ); break;
+    case 'o': order = atoi( optarg ); break;
+    case 'g': gain = atof( optarg ); break;
+    default: usage();
+    }
+  }
+  if ( channels < 1 || polynomials < 1 || order < 0 || order > 3 || samplerate <= 0.0 )
+    usage();
+
+  // calibration polynomials, similar to the ones of a PCI-6259 in the +-10V range:
+  Converter cv( channels );
+  for ( int k=0; k<channels; k++ ) {
+    int p = k % polynomials;
+    double coeffs[4] = { -1.0e-3*(p+1), 3.05e-4*( 1.0 + 1.0e-4*p ), 1.0e-12, -2.0e-17 };
+    cv.setPolynomial( k, order, 0.0, coeffs, 1.0/gain );
+  }
+
+  // simulated raw data of 0.05s as read by ComediThread::read(),
+  // the data of one second are recycled:
+  int chunk = channels * (int)::ceil( 0.05*samplerate );
+  long long n = (long long)::floor( duration*samplerate )*channels;
+  vector< unsigned short > data( channels * (long long)::ceil( samplerate ) );
+  srand( 1 );
+  for ( unsigned long k=0; k<data.size(); k++ )
+    data[k] = 32768 + (int)( 2000.0*sin( 0.001*k ) ) + rand() % 256 - 128;
+  vector< float > out( chunk );
+  vector< float > lout( chunk );
+
+  cout << "conversion of " << duration << "s of data of " << channels << " channels at "
+       << samplerate << "Hz, " << polynomials << " distinct polynomials of order "
+       << cv.order() << "\n";
+#if defined( __AVX2__ )
+  cout << "instruction set: AVX2\n";
+#elif defined( __SSE2__ )
+  cout << "instruction set: SSE2\n";
+#else
+  cout << "instruction set: scalar\n";
+#endif
+
+  // warm up and compare:
+  cv.convert( &data[0], &out[0], chunk, 0 );
+  Converter lcv( cv );
+  lcv.setLookupTable();
+  lcv.convert( &data[0], &lout[0], chunk, 0 );
+  double maxdiff = 0.0;
+  for ( int k=0; k<chunk; k++ ) {
+    if ( fabs( out[k] - lout[k] ) > maxdiff )
+      maxdiff = fabs( out[k] - lout[k] );
+  }
+
+  double tp = benchmark( cv, data, chunk, n, out );
+  double tl = benchmark( lcv, data, chunk, n, lout );
+
+  cout << fixed << setprecision( 3 );
+  cout << "polynomial  : " << setw( 8 ) << 1000.0*tp << "ms, "
+       << setw( 8 ) << 1.0e9*tp/n << "ns per sample, "
+       << setw( 8 ) << 100.0*tp/duration << "% of real time\n";
+  cout << "lookup table: " << setw( 8 ) << 1000.0*tl << "ms, "
+       << setw( 8 ) << 1.0e9*tl/n << "ns per sample, "
+       << setw( 8 ) << 100.0*tl/duration << "% of real time, "
+       << lcv.tables() << " tables of "
+       << Converter::TableSize*sizeof( float )/1024 << "kB\n";
+  cout << "speedup of lookup table: " << tp/tl << "\n";
+  cout << scientific << setprecision( 2 )
+       << "maximum difference: " << maxdiff << "V\n";
+
+  return 0;
+}
+
@@ -0,0 +1,230 @@
+/*
+  fishgridoffsets.cc
+  Estimates the temporal offsets between the boards of a recording.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <deque>
+#include <getopt.h>
+#include <relacs/str.h>
+#include <relacs/strqueue.h>
+#include <relacs/options.h>
+#include "boardoffsets.h"
+using namespace std;
+using namespace relacs;
+
+
+void usage( void )
+{
+  cout << "Usage:\n";
+  cout << "\n";
+  cout << "fishgridoffsets -s START -t TIME -l MAXLAG -n DATAPATH\n";
+  cout << "\n";
+  cout << "Estimates the temporal offsets between the boards of a recording\n";
+  cout << "by cross-correlating the common-mode signals of the boards\n";
+  cout << "and writes them into the configuration file of the recording.\n";
+  cout << "\n";
+  cout << "-s START            start of the analyzed data in seconds (default 0)\n";
+  cout << "-t TIME             duration of the analyzed data in seconds (default 4)\n";
+  cout << "-l MAXLAG           maximum offset in milliseconds (default 5)\n";
+  cout << "-n                  only print the offsets, do not modify the configuration file\n";
+  cout << "DATAPATH            the recording (path or config file)\n";
+  exit( 0 );
+}
+
+
+int main( int argc, char **argv )
+{
+  double start = 0.0;
+  double duration = 4.0;
+  double maxlag = 0.005;
+  bool dryrun = false;
+
+  optind = 0;
+  opterr = 0;
+  int c;
+  while ( (c = getopt( argc, argv, "s:t:l:n" )) >= 0 ) {
+    char *ep = NULL;
+    switch ( c ) {
+    case 's':
+      if ( optarg != NULL ) {
+	double val = strtod( optarg, &ep );
+	if ( ep != optarg )
+	  start = val;
+      }
+      break;
+
+    case 't':
+      if ( optarg != NULL ) {
+	double val = strtod( optarg, &ep );
+	if ( ep != optarg )
+	  duration = val;
+      }
+      break;
+
+    case 'l':
+      if ( optarg != NULL ) {
+	double val = strtod( optarg, &ep );
+	if ( ep != optarg )
+	  maxlag = 0.001*val;
+      }
+      break;
+
+    case 'n':
+      dryrun = true;
+      break;
+
+    default:
+      usage();
+      break;
+    }
+  }
+  if ( argc <= optind )
+    usage();
+
+  // setup path and file names:
+  Str basepath = argv[optind];
+  string configfile = "fishgrid.cfg";
+  if ( basepath.extension() == ".cfg" ) {
+    configfile = basepath.notdir();
+    basepath.stripNotdir();
+  }
+  else
+    basepath.provideSlash();
+  string configpath = basepath + configfile;
+
+  // read configuration file:
+  const int MaxGrids = 4;
+  bool used[MaxGrids];
+  int gridchannels[MaxGrids];
+  int traceoffset[MaxGrids];
+  double samplerate = 10000.0;
+  int channels = 0;
+  vector< int > boardchannels;
+  for ( int g=0; g<MaxGrids; g++ ) {
+    used[g] = false;
+    gridchannels[g] = 0;
+    traceoffset[g] = 0;
+  }
+  cout << "Read in '" << configpath << "' ...\n";
+  ifstream sf( configpath.c_str() );
+  if ( ! sf.good() ) {
+    cerr << "! error: can not open '" << configpath << "'\n";
+    return 1;
+  }
+  string line = "";
+  StrQueue sq;
+  Options acquisition;
+  while ( true ) {
+    sq.clear();
+    sq.load( sf, "*", &line );
+    if ( sq.size() > 0 && sq[0] == "*FishGrid" ) {
+      Options opt( sq );
+      for ( int g=0; g<MaxGrids; g++ ) {
+	string ns = Str( g+1 );
+	used[g] = opt.boolean( "Used"+ns );
+	if ( used[g] ) {
+	  gridchannels[g] = opt.integer( "Rows"+ns, 0, 4 )*opt.integer( "Columns"+ns, 0, 4 );
+	  traceoffset[g] = opt.integer( "ChannelOffset"+ns, 0, 0 );
+	  channels += gridchannels[g];
+	}
+      }
+      samplerate = opt.number( "AISampleRate", "Hz", samplerate );
+    }
+    else if ( sq.size() > 0 && sq[0] == "*Acquisition" )
+      acquisition = Options( sq );
+    if ( ! sf.good() )
+      break;
+  }
+  sf.close();
+
+  // boards acquiring the channels of the grids:
+  int nc = 0;
+  for ( int board=0; board<4 && nc<channels; board++ ) {
+    Str blacklist = acquisition.text( "blacklist" + Str( board+1 ) );
+    vector<int> blackchannels;
+    blacklist.range( blackchannels, ",", "-" );
+    int bc = 32 - blackchannels.size();
+    if ( nc + bc > channels )
+      bc = channels - nc;
+    boardchannels.push_back( bc );
+    nc += bc;
+  }
+  if ( boardchannels.size() < 2 ) {
+    cerr << "! error: need at least two boards for estimating temporal offsets\n";
+    return 1;
+  }
+
+  // read data of all grids:
+  int scans = (int)::floor( duration*samplerate );
+  long long startscan = (long long)::floor( start*samplerate );
+  vector< float > data( (long long)scans*channels );
+  int choffs = 0;
+  for ( int g=0; g<MaxGrids; g++ ) {
+    if ( ! used[g] )
+      continue;
+    string tracefile = basepath + "traces-grid" + Str( g+1 ) + ".raw";
+    ifstream tf( tracefile.c_str() );
+    if ( ! tf.good() ) {
+      cerr << "! error: can not open '" << tracefile << "'\n";
+      return 1;
+    }
+    vector< float > buffer( (long long)scans*gridchannels[g] );
+    tf.seekg( (startscan*gridchannels[g]+traceoffset[g])*sizeof( float ) );
+    tf.read( (char *)&buffer[0], buffer.size()*sizeof( float ) );
+    int n = tf.gcount()/sizeof( float )/gridchannels[g];
+    if ( scans > n )
+      scans = n;
+    for ( int s=0; s<scans; s++ ) {
+      for ( int c=0; c<gridchannels[g]; c++ )
+	data[(long long)s*channels + choffs + c] = buffer[s*gridchannels[g] + c];
+    }
+    choffs += gridchannels[g];
+  }
+  if ( scans < samplerate ) {
+    cerr << "! error: not enough data for estimating temporal offsets\n";
+    return 1;
+  }
+
+  // estimate:
+  BoardOffsets bo;
+  bo.setBoards( boardchannels );
+  bo.setMaxLag( (int)::floor( maxlag*samplerate ) );
+  bo.estimate( &data[0], channels, scans );
+  vector< int > offsets( bo.boards() );
+  cout << "Offsets from " << Str( scans/samplerate, "%.1f" ) << "s of data:\n";
+  for ( int board=0; board<bo.boards(); board++ ) {
+    offsets[board] = bo.offset( board );
+    cout << "  board " << board+1 << ": " << offsets[board]
+	 << " scans, correlation " << Str( bo.correlation( board ), "%.3f" ) << '\n';
+  }
+
+  if ( ! dryrun ) {
+    cout << "Write out '" << configpath << "' ...\n";
+    if ( BoardOffsets::saveOffsets( configpath, offsets ) < 0 ) {
+      cerr << "! error: can not rewrite '" << configpath << "'\n";
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -132,7 +132,8 @@ int main( int argc, char **argv )
     return -1;
   for ( ; ; ) {
     fishgrid.sleep();
-    fishgrid.processData();
+    if ( fishgrid.processData() > 0 )
+      break;
   }
   fishgrid.finish();
   return 0;
@@ -30,14 +30,19 @@
 #include <relacs/optdialog.h>
 #include "datathread.h"
 #include "simulationthread.h"
+#include "replaythread.h"
 #ifdef HAVE_COMEDILIB_H
 #include "comedithread.h"
 #endif
 #ifdef HAVE_NIDAQMXBASE_H
 #include "nidaqmxthread.h"
 #endif
+#ifdef HAVE_LIBUSB_1_0_LIBUSB_H
+#include "daqflexthread.h"
+#endif
 #include "preprocessor.h"
 #include "analyzer.h"
+#include "boardoffsets.h"
 #include "fishgridwidget.h"
 
 using namespace std;
@@ -48,10 +53,11 @@ FishGridWidget::FishGridWidget( double samplerate,
 				double buffertime,
 				double datatime, double datainterval,
 				bool dialog, bool saving, const string &stoptime,
-				bool simulate )
+				bool simulate, const string &replay )
   : BaseWidget( "fishgrid.cfg" ),
     FileSaver( this ),
     AutoSave( saving ),
+    Replay( ! replay.empty() ),
     DataLoop( 0 ),
     MetadataDialog( 0 ),
     TimeStampDialog( 0 )
@@ -83,9 +89,21 @@ FishGridWidget::FishGridWidget( double samplerate,
 #else
 #ifdef HAVE_NIDAQMXBASE_H
   acq = new NIDAQmxThread( this );
+#else
+#ifdef HAVE_LIBUSB_1_0_LIBUSB_H
+  acq = new DAQFlexThread( this );
 #endif
 #endif
-  if ( acq == 0 || simulate ) {
+#endif
+  Str replaypath = replay;
+  if ( ! replaypath.empty() ) {
+    if ( acq != 0 )
+      delete acq;
+    replaypath.provideSlash();
+    printlog( "replaying " + replaypath );
+    DataLoop = new ReplayThread( replaypath, this );
+  }
+  else if ( acq == 0 || simulate ) {
     if ( acq != 0 )
       delete acq;
     printlog( "using simulation" );
@@ -96,9 +114,18 @@ FishGridWidget::FishGridWidget( double samplerate,
     DataLoop = acq;
   }
   FileSaver.setDataThread( DataLoop );
+  // process data whenever the data thread has published new data:
+  connect( DataLoop, SIGNAL( dataAvailable() ),
+	   this, SLOT( processData() ), Qt::QueuedConnection );
+  // and at least every ProcessInterval milliseconds:
+  connect( &ProcessTimer, SIGNAL( timeout() ),
+	   this, SLOT( processData() ) );
 
   // read configuration:
   CFG.read();
+  // grids and sampling rate of the replayed recording:
+  if ( ! replaypath.empty() )
+    CFG.read( 0, replaypath + "fishgrid.cfg" );
 
   for ( int g=0; g<MaxGrids; g++ ) {
     string ns = Str( g+1 );
@@ -221,7 +248,8 @@ void FishGridWidget::start( void )
   else {
     if ( AutoSave )
       startSaving( 1 );
-    QTimer::singleShot( ProcessInterval, this, SLOT( processData() ) );
+    ProcessTime.start();
+    ProcessTimer.start( ProcessInterval );
     if ( StopRecording ) {
       QDateTime ct = QDateTime::currentDateTime();
       qint64 rectime = ct.msecsTo( StopTime );
@@ -255,6 +283,15 @@ void FishGridWidget::unlockAI( int g )
 
 void FishGridWidget::processData( void )
 {
+  // all data acquired:
+  if ( ! DataLoop->running() && DataLoop->endOfData() ) {
+    ProcessTimer.stop();
+    FileSaver.save();
+    printlog( "end of data" );
+    qApp->quit();
+    return;
+  }
+
   // error in acquisition:
   if ( ! DataLoop->running() ) {
     FileSaver.interruptionTimeStamp();
@@ -268,10 +305,21 @@ void FishGridWidget::processData( void )
 
   // save and analyze data:   
   else {
-    string wts = "FishGrid";
+    // save data as soon as they are available:
     string fsm = FileSaver.save();
     if ( ! fsm.empty() )
-      wts += " @ " + fsm;
+      SaveMessage = fsm;
+    else if ( ! FileSaver.saving() )
+      SaveMessage = "";
+
+    // analyze and plot data every ProcessInterval milliseconds only:
+    if ( ProcessTime.elapsed() < ProcessInterval )
+      return;
+    ProcessTime.restart();
+
+    string wts = "FishGrid";
+    if ( ! SaveMessage.empty() )
+      wts += " @ " + SaveMessage;
 
     if ( CurrentAnalyzer != 0 ) {
 
@@ -289,20 +337,63 @@ void FishGridWidget::processData( void )
       for ( int g=0; g<MaxGrids; g++ ) {
 	if ( Used[g] ) {
 	  // index of first data element to be analyzed:
-	  lockAI( g );
-	  long long size = inputBuffer( g ).size();
-	  long long mininx = inputBuffer( g ).minIndex();
-	  unlockAI( g );
+	  long long size = inputRing( g ).size();
+	  long long mininx = inputRing( g ).minIndex();
 	  long long inx = size - (int)::floor(DataTime*SampleRate)*GridChannels[g];
 	  mininx += (int)::floor( GridChannels[g]*SampleRate );  // add 1 second for incoming new data
 	  if ( inx < mininx )
 	    inx = mininx;
-	  inx = (inx/GridChannels[g])*GridChannels[g];
-	  // copy data from buffer:
-	  while ( inx<size-GridChannels[g] ) {
+	  int nb = DataLoop->blockSize( g );
+	  int bs = DataLoop->blockSamples();
+	  inx = ((inx+nb-1)/nb)*nb;
+	  long long upto = bs > 0 ? (size/nb)*nb : ((size-1)/GridChannels[g])*GridChannels[g];
+	  if ( upto <= inx )
+	    continue;
+	  // contiguous float data directly from the buffer memory,
+	  // or converted if the data are raw or wrap around:
+	  const float *data[2];
+	  long long n[2];
+	  int ns = 0;
+	  if ( ! DataLoop->rawInput() )
+	    ns = inputBuffer( g ).spans( inx, upto, data[0], n[0], data[1], n[1] );
+	  if ( ns != 1 ) {
+	    ConvertBuffer.resize( upto - inx );
+	    n[0] = DataLoop->convert( g, inx, upto, &ConvertBuffer[0] );
+	    data[0] = &ConvertBuffer[0];
+	    if ( n[0] <= 0 )
+	      continue;
+	  }
+	  if ( bs > 0 ) {
+	    // blocked layout, unit stride for each channel:
+	    for ( long long b=0; b<n[0]; b+=nb ) {
+	      const float *bp = data[0] + b;
+	      for ( int r=0; r<Rows[g]; r++ ) {
+		for ( int c=0; c<Columns[g]; c++ ) {
+		  for ( int t=0; t<bs; t++ )
+		    Data[g][r][c].push( 1000.0*bp[t] );  // convert to Millivolt
+		  bp += bs;
+		}
+	      }
+	    }
+	  }
+	  else {
+	    // interleaved layout:
+	    int r = 0;
+	    int c = 0;
+	    for ( long long k=0; k<n[0]; k++ ) {
+	      Data[g][r][c].push( 1000.0*data[0][k] );  // convert to Millivolt
+	      if ( ++c >= Columns[g] ) {
+		c = 0;
+		if ( ++r >= Rows[g] )
+		  r = 0;
+	      }
+	    }
+	  }
+	  // data overwritten while they were copied:
+	  if ( inputRing( g ).validIndex() > inx ) {
 	    for ( int r=0; r<Rows[g]; r++ ) {
 	      for ( int c=0; c<Columns[g]; c++ )
-		Data[g][r][c].push( 1000.0*inputBuffer( g )[inx++] );  // convert to Millivolt
+		Data[g][r][c].clear();
 	    }
 	  }
 	}
@@ -322,8 +413,6 @@ void FishGridWidget::processData( void )
     }
     setWindowTitle( wts.c_str() );
   }
-    
-  QTimer::singleShot( ProcessInterval, this, SLOT( processData() ) );
 }
 
 
@@ -334,7 +423,9 @@ void FishGridWidget::finish( void )
     setWindowTitle( "FishGrid" );
   }
   printlog( "quitting FishGrid" );
-  CFG.save();
+  // the configuration of a replay is the one of the recording:
+  if ( ! Replay )
+    CFG.save();
   DataLoop->stop();
 }
 
@@ -354,6 +445,95 @@ void FishGridWidget::startSaving( int r )
 }
 
 
+void FishGridWidget::estimateOffsets( double time )
+{
+  if ( DataLoop == 0 || DataLoop->boards() < 2 ) {
+    printlog( "! warning in FishGridWidget::estimateOffsets() -> need at least two boards" );
+    return;
+  }
+
+  // the most recent scans available in all grids:
+  int bs = DataLoop->blockSamples();
+  int sb = bs > 0 ? bs : 1;
+  long long from = 0;
+  long long upto = -1;
+  for ( int g=0; g<MaxGrids; g++ ) {
+    if ( Used[g] ) {
+      long long size = inputRing( g ).size()/GridChannels[g];
+      long long mininx = inputRing( g ).minIndex()/GridChannels[g];
+      mininx += (long long)::floor( SampleRate );  // add 1 second for incoming new data
+      if ( upto < 0 || upto > size )
+	upto = size;
+      if ( from < mininx )
+	from = mininx;
+    }
+  }
+  upto = (upto/sb)*sb;
+  long long maxscans = (long long)::floor( time*SampleRate );
+  if ( from < upto - maxscans )
+    from = upto - maxscans;
+  from = ((from+sb-1)/sb)*sb;
+  if ( upto - from < SampleRate ) {
+    printlog( "! warning in FishGridWidget::estimateOffsets() -> not enough data" );
+    return;
+  }
+
+  // interleaved scans of all channels of all grids:
+  int scans = upto - from;
+  vector< float > data( (long long)scans*Channels );
+  int choffs = 0;
+  for ( int g=0; g<MaxGrids; g++ ) {
+    if ( Used[g] ) {
+      int gc = GridChannels[g];
+      ConvertBuffer.resize( (long long)scans*gc );
+      if ( DataLoop->convert( g, from*gc, upto*gc, &ConvertBuffer[0] ) != (long long)scans*gc ) {
+	printlog( "! warning in FishGridWidget::estimateOffsets() -> data of grid "
+		  + Str( g+1 ) + " not available anymore" );
+	return;
+      }
+      for ( long long k=0; k<(long long)scans*gc; k++ ) {
+	long long s = k/gc;
+	int c = k%gc;
+	if ( bs > 0 ) {
+	  // blocked layout:
+	  long long b = k/(bs*gc);
+	  int e = k%(bs*gc);
+	  c = e/bs;
+	  s = b*bs + e%bs;
+	}
+	data[s*Channels + choffs + c] = ConvertBuffer[k];
+      }
+      choffs += gc;
+    }
+  }
+
+  // estimate:
+  vector< int > boardchannels( DataLoop->boards() );
+  for ( int b=0; b<DataLoop->boards(); b++ )
+    boardchannels[b] = DataLoop->boardChannels( b );
+  BoardOffsets bo;
+  bo.setBoards( boardchannels );
+  bo.setMaxLag( (int)::floor( 0.005*SampleRate ) );
+  if ( bo.estimate( &data[0], Channels, scans ) < 0 ) {
+    printlog( "! warning in FishGridWidget::estimateOffsets() -> boards do not match the grids" );
+    return;
+  }
+
+  // store offsets:
+  vector< int > offsets( bo.boards() );
+  for ( int b=0; b<bo.boards(); b++ ) {
+    offsets[b] = bo.offset( b );
+    string ns = Str( b+1 );
+    printlog( "offset of board " + ns + ": " + Str( offsets[b] ) + " scans, correlation "
+	      + Str( bo.correlation( b ), "%.3f" ) + " from " + Str( scans/SampleRate, "%.1f" ) + "s of data" );
+    if ( DataLoop->exist( "offset"+ns ) )
+      DataLoop->setInteger( "offset"+ns, offsets[b] );
+  }
+  if ( FileSaver.saving() )
+    BoardOffsets::saveOffsets( FileSaver.path() + "fishgrid.cfg", offsets );
+}
+
+
 void FishGridWidget::saveTimeStamp( int r )
 {
   if ( TimeStampDialog != 0 )
@@ -378,11 +558,13 @@ void FishGridWidget::keyPressEvent( QKeyEvent *event )
   case Qt::Key_Q :
     DataInterval /= 2.0;
     ProcessInterval /= 2;
+    ProcessTimer.setInterval( ProcessInterval );
     break;
 
   case Qt::Key_W :
     DataInterval *= 2.0;
     ProcessInterval *= 2;
+    ProcessTimer.setInterval( ProcessInterval );
     break;
 
   case Qt::Key_Enter :
@@ -425,6 +607,15 @@ void FishGridWidget::keyPressEvent( QKeyEvent *event )
     TimeStampDialog->exec();
     break;
 
+  case Qt::Key_O :
+    if ( event->modifiers() & Qt::ControlModifier )
+      estimateOffsets();
+    else {
+      event->ignore();
+      return;
+    }
+    break;
+
   default:
     event->ignore();
     return;
@@ -19,24 +19,38 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cmath>
 #include "nidaqmxthread.h"
 
 
 NIDAQmxThread::NIDAQmxThread( ConfigData *cd )
   : DataThread( "Acquisition", cd ),
-    Handle( 0 )
+    Handle( 0 ),
+    Binary( false ),
+    ReadScans( 0 ),
+    DirectGrid( -1 )
 {
   addSelection( "reference", "RSE|DIFF|RSE|NRSE" );
+  addBoolean( "binary", false );
+  addNumber( "readinterval", 0.01, "s" );
+}
+
+
+bool NIDAQmxThread::rawInputSupported( void )
+{
+  // raw counts need unscaled samples:
+  return boolean( "binary" );
 }
 
 
 int NIDAQmxThread::initialize( double duration )
 {
-  // XXX add multi-grid support
   // XXX add finite samples support
   int32 error = 0;
   char errstr[2048];
 
+  Binary = boolean( "binary" );
+
   //create an acquisition task:
   error = DAQmxBaseCreateTask( "AI", &Handle );
   if ( error != 0 ) {
@@ -69,7 +83,10 @@ int NIDAQmxThread::initialize( double duration )
   }
 
   // timing:
-  uInt64 samplesperchan = (int)::floor( sampleRate()*interval() ); // XXX should be ignored in continues acquisition ????
+  ReadScans = (int)::ceil( sampleRate()*number( "readinterval" ) );
+  if ( ReadScans < 1 )
+    ReadScans = 1;
+  uInt64 samplesperchan = ReadScans; // XXX should be ignored in continues acquisition ????
   printlog( "NIDAQmxBase sampling rate: " + Str( sampleRate() ) + "Hz" );
   printlog( "NIDAQmxBase samples per channel: " + Str( (long)samplesperchan ) );
   error = DAQmxBaseCfgSampClkTiming( Handle, "OnboardClock", sampleRate(), DAQmx_Val_Rising,
@@ -94,7 +111,53 @@ int NIDAQmxThread::initialize( double duration )
     return -4;
   }
 
-  printlog( "NIDAQmxThread interval=" + Str( 1000.0*interval() ) + "ms" );
+  printlog( "NIDAQmxThread interval=" + Str( 1000.0*ReadScans/sampleRate() ) + "ms" );
+
+  // routing of the channels to the grids:
+  Plan.clear();
+  DirectGrid = -1;
+  for ( int g=0; g<maxGrids(); g++ ) {
+    if ( used( g ) ) {
+      for ( int k=0; k<gridChannels( g ); k++ )
+	Plan.add( 0, g );
+      if ( gridChannels( g ) == channels() && blockSamples() == 0 )
+	DirectGrid = g;
+    }
+  }
+  setBoards( Plan );
+
+  // staging buffers:
+  int nc = channels();
+  BinaryData.resize( Binary ? ReadScans*nc : 0 );
+  ScaledData.resize( Binary ? 0 : ReadScans*nc );
+  Converted.resize( DirectGrid < 0 && ! rawInput() ? ReadScans*nc : 0 );
+
+  if ( Binary ) {
+    // nominal gain of the input range of the USB-621x devices:
+    double ranges[4] = { 0.2, 1.0, 5.0, 10.0 };
+    double range = ranges[3];
+    for ( int k=0; k<4; k++ ) {
+      if ( ranges[k] >= maxVolts()*gain() ) {
+	range = ranges[k];
+	break;
+      }
+    }
+    printlog( "NIDAQmxBase reads unscaled samples of the +/-" + Str( range ) + "V range" );
+    double coeffs[4] = { 0.0, range/32768.0, 0.0, 0.0 };
+    Convert.setChannels( nc );
+    for ( int c=0; c<nc; c++ )
+      Convert.setPolynomial( c, 1, 0.0, coeffs, 1.0/gain() );
+    if ( rawInput() ) {
+      // offset binary counts:
+      coeffs[1] /= gain();
+      for ( int g=0; g<maxGrids(); g++ ) {
+	if ( used( g ) ) {
+	  for ( int c=0; c<gridChannels( g ); c++ )
+	    setCalibration( g, c, 1, 32768.0, coeffs );
+	}
+      }
+    }
+  }
 
   // start acquisition:
   error = DAQmxBaseStartTask( Handle );
@@ -114,6 +177,45 @@ void NIDAQmxThread::finish( void )
 {
   DAQmxBaseStopTask( Handle );
   DAQmxBaseClearTask( Handle );
+  Handle = 0;
+}
+
+
+int NIDAQmxThread::transferScans( int scans )
+{
+  int nc = channels();
+  bool raw = rawInput();
+  int k = 0;
+  while ( k < scans ) {
+    float *fp[maxGrids()];
+    RawSample *rp[maxGrids()];
+    int n = claimScans( scans - k, fp, rp );
+    if ( n <= 0 ) {
+      printlog( "! error in NIDAQmxThread::read() -> no space for a whole scan in the input buffers" );
+      return -1;
+    }
+    if ( raw )
+      Plan.execute( 0, (const RawSample *)&BinaryData[k*nc], n, rp );
+    else if ( Binary ) {
+      if ( DirectGrid >= 0 )
+	Convert.convert( &BinaryData[k*nc], fp[DirectGrid], n*nc );
+      else {
+	Convert.convert( &BinaryData[k*nc], &Converted[0], n*nc );
+	Plan.execute( 0, &Converted[0], n, fp );
+      }
+    }
+    else {
+      float *cp = DirectGrid >= 0 ? fp[DirectGrid] : &Converted[0];
+      const float64 *sp = &ScaledData[k*nc];
+      for ( int i=0; i<n*nc; i++ )
+	cp[i] = (float)(sp[i]/gain());
+      if ( DirectGrid < 0 )
+	Plan.execute( 0, &Converted[0], n, fp );
+    }
+    pushScans( n );
+    k += n;
+  }
+  return 0;
 }
 
 
@@ -122,49 +224,37 @@ int NIDAQmxThread::read( void )
   // XXX add finite samples support
 
   // get data from daq driver:
-  int32 pointstoread = (int32)::floor( interval()*sampleRate() );
   float64 timeout = 1.0;
-  int buffersize = pointstoread*channels();
-  float64 buffer[buffersize];
   int32 pointsread = 0;
-  int32 error = DAQmxBaseReadAnalogF64( Handle, pointstoread, timeout,
-					DAQmx_Val_GroupByScanNumber,
-					buffer, buffersize, &pointsread, NULL );
+  int32 error = 0;
+  if ( Binary )
+    error = DAQmxBaseReadBinaryI16( Handle, ReadScans, timeout,
+				    DAQmx_Val_GroupByScanNumber,
+				    &BinaryData[0], BinaryData.size(), &pointsread, NULL );
+  else
+    error = DAQmxBaseReadAnalogF64( Handle, ReadScans, timeout,
+				    DAQmx_Val_GroupByScanNumber,
+				    &ScaledData[0], ScaledData.size(), &pointsread, NULL );
   if ( error != 0 ) {
+    // the board's buffer overflowed (DAQmxErrorSamplesNoLongerAvailable):
+    if ( error == -200279 )
+      countOverrun();
     char errstr[2048];
     DAQmxBaseGetExtendedErrorInfo( errstr, 2048 );
     DAQmxBaseStopTask( Handle );
     DAQmxBaseClearTask( Handle );
+    Handle = 0;
     printlog( "NIDAQmxBase: ! error no." + Str( error ) + "[" + Str( errstr ) + "]" );
     return -1;
   }
 
-  // transfer data to buffer:
-  /*
-  lockAI();
-  for ( int k=0; k<pointsread*channels(); k++ )
-    inputBuffer().push( (float)(buffer[k]/gain()) );
-  unlockAI();
-  */
-
-  // transfer data to input buffer:
-  int bufferinx = 0;
-  int buffern = pointsread*channels();
-  do {
-    int pn = 0;
-    int m = inputBuffer().maxPush();
-    float *fp = inputBuffer().pushBuffer();
-    while ( m > 0 && bufferinx < buffern ) {
-      *(fp++) = (float)(buffer[bufferinx++]/gain());
-      pn++;
-      m--;
-    }
-    lockAI();
-    inputBuffer().push( pn );
-    unlockAI();
-  } while ( bufferinx < buffern );
-
+  // raw counts are stored as offset binary:
+  if ( rawInput() ) {
+    RawSample *rp = (RawSample *)&BinaryData[0];
+    for ( int k=0; k<pointsread*channels(); k++ )
+      rp[k] ^= 0x8000;
+  }
 
-  return 0;
+  // transfer data to the input buffers:
+  return transferScans( pointsread );
 }
-
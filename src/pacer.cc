@@ -0,0 +1,85 @@
+/*
+  pacer.cc
+  Paces the generation of scans against absolute deadlines.
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <cerrno>
+#include <time.h>
+#include "pacer.h"
+
+
+Pacer::Pacer( void )
+  : Rate( 1.0 ),
+    StartTime( 0 ),
+    Deadline( 0 ),
+    Interval( 0 ),
+    Behind( false ),
+    FellBehind( false )
+{
+}
+
+
+void Pacer::start( double rate, int scans )
+{
+  Rate = rate > 0.0 ? rate : 1.0;
+  if ( scans < 1 )
+    scans = 1;
+  Interval = (long long)::rint( 1.0e9*scans/Rate );
+  StartTime = nanoseconds();
+  Deadline = StartTime + Interval;
+  Behind = false;
+  FellBehind = false;
+}
+
+
+long long Pacer::wait( void )
+{
+  struct timespec ts;
+  ts.tv_sec = Deadline/1000000000LL;
+  ts.tv_nsec = Deadline%1000000000LL;
+  while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL ) == EINTR );
+  long long n = (long long)::floor( 1.0e-9*(Deadline - StartTime)*Rate );
+  Deadline += Interval;
+  // how late we are for the next deadline:
+  long long late = nanoseconds() - Deadline;
+  FellBehind = false;
+  if ( late > 1000000000LL ) {
+    FellBehind = ! Behind;
+    Behind = true;
+  }
+  else if ( late <= 0 )
+    Behind = false;
+  return n;
+}
+
+
+bool Pacer::fellBehind( void ) const
+{
+  return FellBehind;
+}
+
+
+long long Pacer::nanoseconds( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
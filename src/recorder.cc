@@ -27,6 +27,9 @@
 #ifdef HAVE_NIDAQMXBASE_H
 #include "nidaqmxthread.h"
 #endif
+#ifdef HAVE_LIBUSB_1_0_LIBUSB_H
+#include "daqflexthread.h"
+#endif
 #include "recorder.h"
 
 using namespace std;
@@ -38,6 +41,7 @@ Recorder::Recorder( double samplerate,
   : ConfigData( "fishgrid.cfg" ),
     FileSaver( this ),
     DataLoop( 0 ),
+    DataNotifications( 0 ),
     FileSaving( false )
 {
   MaxVolts = maxvolts;
@@ -53,6 +57,10 @@ Recorder::Recorder( double samplerate,
 #else
 #ifdef HAVE_NIDAQMXBASE_H
   acq = new NIDAQmxThread( this );
+#else
+#ifdef HAVE_LIBUSB_1_0_LIBUSB_H
+  acq = new DAQFlexThread( this );
+#endif
 #endif
 #endif
   if ( acq == 0 || simulate ) {
@@ -157,6 +165,13 @@ void Recorder::printlog( const string &message ) const
 
 int Recorder::processData( void )
 {
+  // all data acquired:
+  if ( ! DataLoop->running() && DataLoop->endOfData() ) {
+    FileSaver.save();
+    printlog( "end of data" );
+    return 1;
+  }
+
   // error in acquisition:
   if ( ! DataLoop->running() ) {
     FileSaver.interruptionTimeStamp();
@@ -186,7 +201,7 @@ void Recorder::finish( void )
 
 void Recorder::sleep( void )
 {
-  QThread::msleep( ProcessInterval );
+  DataLoop->waitForData( DataNotifications, ProcessInterval );
 }
 
 
@@ -195,7 +210,8 @@ void Recorder::run( void )
   bool fs = true;
   do {
     sleep();
-    processData();
+    if ( processData() > 0 )
+      break;
     FileSavingMutex.lock();
     fs = FileSaving;
     FileSavingMutex.unlock();
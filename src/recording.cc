@@ -21,6 +21,7 @@
 
 #include <ctime>
 #include <sstream>
+#include <fstream>
 #include <QDir>
 #include <QDateTime>
 #include "recording.h"
@@ -33,6 +34,7 @@ Recording::Recording( ConfigData *cd, DataThread *dt )
     Save( false ),
     PathTemplate( "%04Y-%02m-%02d-%02H:%02M" ),
     PathNumber( 0 ),
+    FirstClockIndex( 0 ),
     LogFile( 0 )
 {
   addText( "PathFormat", PathTemplate );
@@ -133,6 +135,8 @@ string Recording::start( bool tracefiles, bool timestamps )
 	fp.saveXML( xml, 2 );
       }
     }
+    fp.setText( Path + "clockmap.dat" );
+    fp.saveXML( xml, 2 );
   }
   if ( timestamps ) {
     fp.setText( Path + "timestamps.dat" );
@@ -179,6 +183,14 @@ string Recording::start( bool tracefiles, bool timestamps )
   xml << "      <type>hardware/amplifier</type>\n";
   CD->Options::saveXML( xml, 256, 3 );
   xml << "    </section>\n";
+  if ( DT != 0 ) {
+    Options sched;
+    DT->schedulingOptions( sched );
+    xml << "    <section>\n";
+    xml << "      <type>software/acquisition_thread</type>\n";
+    sched.saveXML( xml, 0, 3 );
+    xml << "    </section>\n";
+  }
   xml << "  </section>\n";
   xml << "</odML>\n";
   xml.flush();
@@ -236,13 +248,17 @@ void Recording::openTraceFiles( const string &name )
 {
   for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
     if ( CD->Used[g] ) {
-      DT->lockAI( g );
       TraceFile[g].open( string( Path + "traces-grid" + Str(g+1) + name + ".raw" ).c_str(), ios::out | ios::binary );
-      FirstTraceIndex[g] = (DT->inputBuffer( g ).size()/CD->GridChannels[g])*CD->GridChannels[g];
-      TraceIndex[g] = FirstTraceIndex[g];
-      DT->unlockAI( g );
+      FirstTraceIndex[g] = (DT->inputRing( g ).size()/DT->blockSize( g ))*DT->blockSize( g );
+      TraceReader[g].attach( DT->inputRing( g ), FirstTraceIndex[g] );
     }
   }
+  ClockFile.open( string( Path + "clockmap" + name + ".dat" ).c_str(), ios::out | ios::binary );
+  for ( int g=ConfigData::MaxGrids-1; g>=0; g-- ) {
+    if ( CD->Used[g] )
+      FirstClockIndex = FirstTraceIndex[g]/CD->GridChannels[g];
+  }
+  ClockReader.attach( DT->clockStamps() );
   TraceFilesOpen = true;
 }
 
@@ -255,6 +271,8 @@ void Recording::closeTraceFiles( void )
       if ( CD->Used[g] )
 	TraceFile[g].close();
     }
+    ClockFile.close();
+    ClockReader.detach();
     TraceFilesOpen = false;
   }
 }
@@ -268,14 +286,21 @@ string Recording::save( void )
   string message = "";
   for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
     if ( CD->Used[g] ) {
-      DT->lockAI( g );
-      long long buffersize = DT->inputBuffer( g ).size();
-      DT->unlockAI( g );
-      int n = DT->inputBuffer( g ).saveBinary( TraceFile[g], TraceIndex[g], buffersize );
+      DT->reportLag( g, TraceReader[g].lag() );
+      long long lost = TraceReader[g].recover( DT->blockSize( g ) );
+      if ( lost > 0 ) {
+	printlog( "! error in saving data of grid " + Str( g+1 ) + ": lost "
+		  + Str( (long)lost ) + " data elements, in total "
+		  + Str( (long)TraceReader[g].lost() ) + " data elements." );
+	eventTimeStamp( "lost " + Str( (long)(lost/CD->GridChannels[g]) ) + " samples of grid " + Str( g+1 ) );
+      }
+      long long index = TraceReader[g].readIndex();
+      long long buffersize = index + TraceReader[g].readSize();
+      long long n = saveTraces( g, index, buffersize );
       if ( n > 0 ) {
-	TraceIndex[g] += n;
+	TraceReader[g].read( n );
 	if ( message.empty() ) {
-	  double recsecs = ((TraceIndex[g]-FirstTraceIndex[g])/CD->GridChannels[g])/CD->SampleRate;
+	  double recsecs = ((TraceReader[g].readIndex()-FirstTraceIndex[g])/CD->GridChannels[g])/CD->SampleRate;
 	  qint64 recmsecs = (qint64)( ::round( 1000.0*recsecs ) );
 	  QDateTime rectime = StartRecTime.addMSecs( recmsecs );
 	  double rechours = floor(recsecs/3600);
@@ -285,38 +310,163 @@ string Recording::save( void )
 	  message = Str( rechours, "%02.0f" ) + ":" + Str( recminutes, "%02.0f" ) + ":" + Str( recsecs, "%02.0f" ) + " " + rectime.toString( Qt::ISODate ).toStdString() + " saving data to " + Path;
 	}
       }
-      else if ( n < 0 ) {
+      else if ( n < 0 && n != -2 ) {
 	static const string errormsgs[4] = { "file not open", "nothing to be written", "request to write after buffer end", "skipped a cycle" };
 	n = -n;
 	string msg = "";
-	if ( n < 4 )
+	if ( n <= 4 )
 	  msg = errormsgs[n-1];
 	else
-	  msg = Str( n );
-	printlog( "error in saving data, saveBinary() returned " + Str( n ) + ":" + msg );
+	  msg = Str( (long)n );
+	printlog( "error in saving data, saveTraces() returned " + Str( (long)n ) + ":" + msg );
 	return "save error " + msg;
       }
     }
   }
+  saveClocks();
   return message;
 }
 
 
+void Recording::saveClocks( void )
+{
+  long long lost = ClockReader.recover( 1 );
+  if ( lost > 0 )
+    printlog( "! error in saving clock stamps: lost " + Str( (long)lost ) + " clock stamps." );
+  const CyclicBuffer< DataThread::ClockStamp > &clocks = DT->clockStamps();
+  long long index = ClockReader.readIndex();
+  long long n = ClockReader.readSize();
+  ClockBuffer.resize( n );
+  for ( long long k=0; k<n; k++ )
+    ClockBuffer[k] = clocks[index+k];
+  // clock stamps overwritten while they were copied:
+  long long skip = ClockReader.validate( index, index+n );
+  if ( skip > 0 )
+    printlog( "! error in saving clock stamps: lost " + Str( (long)skip ) + " clock stamps." );
+  for ( long long k=skip; k<n; k++ ) {
+    // three little-endian 64-bit integers:
+    const DataThread::ClockStamp &cs = ClockBuffer[k];
+    long long fields[3] = { cs.Index - FirstClockIndex, cs.Monotonic, cs.Realtime };
+    unsigned char record[24];
+    for ( int f=0; f<3; f++ ) {
+      unsigned long long v = fields[f];
+      for ( int b=0; b<8; b++ )
+	record[8*f+b] = ( v >> ( 8*b ) ) & 0xff;
+    }
+    ClockFile.write( (const char *)record, sizeof( record ) );
+  }
+  ClockReader.read( n );
+  ClockFile.flush();
+}
+
+
+long long Recording::saveTraces( int g, long long from, long long upto )
+{
+  if ( !TraceFile[g] )
+    return -1;
+  if ( from == upto )
+    return -2;
+  if ( from > upto )
+    return -3;
+  int nc = CD->GridChannels[g];
+  int bs = DT->blockSamples();
+
+  // interleaved floats are written directly out of the input buffer:
+  if ( ! DT->rawInput() && bs <= 0 ) {
+    const float *d1;
+    const float *d2;
+    long long n1, n2;
+    int r = DT->inputBuffer( g ).spans( from, upto, d1, n1, d2, n2 );
+    if ( r < 0 )
+      return r;
+    TraceFile[g].write( (const char *)d1, sizeof( float )*n1 );
+    if ( n2 > 0 )
+      TraceFile[g].write( (const char *)d2, sizeof( float )*n2 );
+    // data overwritten while they were written stay in the file
+    // to keep the time axis, but are marked as lost:
+    long long skip = TraceReader[g].validate( from, upto, nc );
+    if ( skip > 0 ) {
+      printlog( "! error in saving data of grid " + Str( g+1 ) + ": lost "
+		+ Str( (long)skip ) + " data elements while writing them, in total "
+		+ Str( (long)TraceReader[g].lost() ) + " data elements." );
+      eventTimeStamp( "lost " + Str( (long)(skip/nc) ) + " samples of grid " + Str( g+1 ) );
+    }
+    TraceFile[g].flush();
+    return upto - from;
+  }
+
+  // copy, convert raw data, and transpose blocks in chunks:
+  int nb = DT->blockSize( g );
+  long long chunk = bs > 0 ? ( bs < 1024 ? 1024/bs : 1 )*nb : 1024*nc;
+  if ( (long long)ConvertBuffer.size() < chunk )
+    ConvertBuffer.resize( chunk );
+  if ( bs > 0 && (long long)TransposeBuffer.size() < chunk )
+    TransposeBuffer.resize( chunk );
+  long long n = 0;
+  while ( from < upto ) {
+    long long m = upto - from;
+    if ( m > chunk )
+      m = chunk;
+    long long r = DT->convert( g, from, from+m, &ConvertBuffer[0] );
+    if ( r < 0 && r != -5 )
+      return r;
+    // data overwritten while they were copied:
+    long long skip = TraceReader[g].validate( from, from+m, nb );
+    if ( skip > 0 ) {
+      printlog( "! error in saving data of grid " + Str( g+1 ) + ": lost "
+		+ Str( (long)skip ) + " data elements while copying them, in total "
+		+ Str( (long)TraceReader[g].lost() ) + " data elements." );
+      eventTimeStamp( "lost " + Str( (long)(skip/nc) ) + " samples of grid " + Str( g+1 ) );
+    }
+    const float *data = &ConvertBuffer[skip];
+    if ( bs > 0 ) {
+      // the file is interleaved:
+      for ( long long b=skip; b<m; b+=nb ) {
+	const float *bp = &ConvertBuffer[b];
+	float *tp = &TransposeBuffer[b];
+	for ( int c=0; c<nc; c++ ) {
+	  for ( int t=0; t<bs; t++ )
+	    tp[t*nc+c] = *(bp++);
+	}
+      }
+      data = &TransposeBuffer[skip];
+    }
+    TraceFile[g].write( (const char *)data, sizeof( float )*(m-skip) );
+    from += m;
+    n += m;
+  }
+  TraceFile[g].flush();
+  return n;
+}
+
+
 void Recording::stop( void )
 {
   if ( ! Save )
     return;
 
+  // statistics of the data acquisition:
+  Options stats;
+  DT->statsOptions( stats );
+
   double recsecs = -1.0;
   if ( TraceFilesOpen ) {
     // close trace files:
+    saveClocks();
+    ClockFile.close();
+    ClockReader.detach();
     for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
       if ( CD->Used[g] ) {
 	TraceFile[g].close();
 	if ( recsecs < 0.0 ) {
-	  long long index = TraceIndex[g] - FirstTraceIndex[g];
+	  long long index = TraceReader[g].readIndex() - FirstTraceIndex[g];
 	  recsecs = (index/CD->GridChannels[g])/CD->SampleRate;
 	}
+	if ( TraceReader[g].lost() > 0 )
+	  printlog( "! lost " + Str( (long)(TraceReader[g].lost()/CD->GridChannels[g]) )
+		    + " samples of grid " + Str( g+1 ) + " during the recording" );
+	stats.addInteger( "LostSamples" + Str( g+1 ),
+			  (long)(TraceReader[g].lost()/CD->GridChannels[g]) );
       }
     }
     TraceFilesOpen = false;
@@ -327,7 +477,7 @@ void Recording::stop( void )
     TimeStampOpts.setInteger( "Num", TimeStampNum );
     for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
       if ( CD->Used[g] ) {
-	long long index = TraceIndex[g] - FirstTraceIndex[g];
+	long long index = TraceReader[g].readIndex() - FirstTraceIndex[g];
 	stringstream str;
 	str << index;
 	TimeStampOpts.setText( "Index"+Str(g+1), str.str() );
@@ -344,6 +494,11 @@ void Recording::stop( void )
     TimeStampsOpen = false;
   }
 
+  ostringstream ss;
+  stats.save( ss, "  " );
+  printlog( "acquisition statistics:\n" + ss.str() );
+  appendMetaData( "recording/acquisition_statistics", stats );
+
   // close log file:
   if ( recsecs >= 0.0 ) {
     double rechours = floor(recsecs/3600);
@@ -371,6 +526,12 @@ bool Recording::saving( void ) const
 }
 
 
+string Recording::path( void ) const
+{
+  return Path;
+}
+
+
 void Recording::timeStamp( void )
 {
   if ( ! Save )
@@ -379,7 +540,7 @@ void Recording::timeStamp( void )
   TimeStampOpts.setInteger( "Num", TimeStampNum );
   for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
     if ( CD->Used[g] ) {
-      long long index = TraceIndex[g] - FirstTraceIndex[g];
+      long long index = TraceReader[g].readIndex() - FirstTraceIndex[g];
       stringstream str;
       str << index;
       TimeStampOpts.setText( "Index"+Str(g+1), str.str() );
@@ -420,12 +581,21 @@ void Recording::interruptionTimeStamp( void )
   // save remaining data in the buffer:
   save();
 
-  // setup time stamp
+  eventTimeStamp( "interrupted data acquisition" );
+}
+
+
+void Recording::eventTimeStamp( const string &comment )
+{
+  if ( ! TimeStampsOpen )
+    return;
+
+  // setup time stamp without touching TimeStampOpts:
   Options opt( TimeStampOpts );
   opt.setInteger( "Num", TimeStampNum );
   for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
     if ( CD->Used[g] ) {
-      long long index = TraceIndex[g] - FirstTraceIndex[g];
+      long long index = TraceReader[g].readIndex() - FirstTraceIndex[g];
       stringstream str;
       str << index;
       opt.setText( "Index"+Str(g+1), str.str() );
@@ -434,7 +604,7 @@ void Recording::interruptionTimeStamp( void )
   opt.setCurrentDate( "Date" );
   QTime qtt = QTime::currentTime();
   opt.setTime( "Time", qtt.hour(), qtt.minute(), qtt.second(), qtt.msec() );
-  opt.setText( "Comment", "interrupted data acquisition" );
+  opt.setText( "Comment", comment );
 
   // save time stamp:
   opt.save( TimeStampFile );
@@ -444,6 +614,32 @@ void Recording::interruptionTimeStamp( void )
 }
 
 
+void Recording::appendMetaData( const string &type, const Options &opts )
+{
+  // replace the closing tag of the metadata file by a new section:
+  string file = Path + "metadata.xml";
+  const string endtag = "</odML>\n";
+  fstream xml( file.c_str(), ios::in | ios::out );
+  xml.seekg( 0, ios::end );
+  long pos = (long)xml.tellg() - (long)endtag.size();
+  string tail( endtag.size(), ' ' );
+  if ( pos >= 0 ) {
+    xml.seekg( pos );
+    xml.read( &tail[0], tail.size() );
+  }
+  if ( ! xml.good() || pos < 0 || tail != endtag ) {
+    printlog( "! warning in Recording::appendMetaData() -> cannot append to " + file );
+    return;
+  }
+  xml.seekp( pos );
+  xml << "  <section>\n";
+  xml << "    <type>" << type << "</type>\n";
+  opts.saveXML( xml, 0, 2 );
+  xml << "  </section>\n";
+  xml << endtag;
+}
+
+
 Options &Recording::timeStampOpts( void )
 {
   return TimeStampOpts;
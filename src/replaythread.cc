@@ -0,0 +1,271 @@
+/*
+  replaythread.cc
+  DataThread implementation for replaying recorded data
+
+  FishGrid
+  Copyright (C) 2009 Jan Benda <benda@bio.lmu.de> & Joerg Henninger <henninger@bio.lmu.de>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+  
+  FishGrid is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <relacs/str.h>
+#include <relacs/options.h>
+#include "replaythread.h"
+
+
+ReplayThread::ReplayThread( const string &path, ConfigData *cd )
+  : DataThread( "Replay", cd ),
+    Path( path ),
+    Scans( 0 ),
+    Position( 0 ),
+    NextTimeStamp( 0 ),
+    Speed( 1.0 ),
+    Loop( false )
+{
+  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
+    Traces[g] = 0;
+    TraceSize[g] = 0;
+  }
+  addNumber( "speed", Speed );
+  addBoolean( "loop", Loop );
+  addNumber( "readinterval", 0.01, "s" );
+}
+
+
+string ReplayThread::path( void ) const
+{
+  return Path;
+}
+
+
+bool ReplayThread::rawInputSupported( void )
+{
+  // the recording holds floats:
+  return false;
+}
+
+
+int ReplayThread::initialize( double duration )
+{
+  Speed = number( "speed" );
+  Loop = boolean( "loop" );
+
+  // map the trace files:
+  Scans = -1;
+  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
+    if ( ! used( g ) )
+      continue;
+    string file = Path + "traces-grid" + Str( g+1 ) + ".raw";
+    int fd = ::open( file.c_str(), O_RDONLY );
+    struct stat st;
+    if ( fd < 0 || fstat( fd, &st ) != 0 || st.st_size <= 0 ) {
+      printlog( "! error in ReplayThread::initialize() -> can not open " + file );
+      if ( fd >= 0 )
+	::close( fd );
+      finish();
+      return -1;
+    }
+    TraceSize[g] = st.st_size;
+    void *m = mmap( 0, TraceSize[g], PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if ( m == MAP_FAILED ) {
+      printlog( "! error in ReplayThread::initialize() -> can not map " + file
+		+ ": " + strerror( errno ) );
+      TraceSize[g] = 0;
+      finish();
+      return -1;
+    }
+    madvise( m, TraceSize[g], MADV_SEQUENTIAL );
+    Traces[g] = (const float *)m;
+    long long scans = TraceSize[g]/sizeof( float )/gridChannels( g );
+    if ( Scans < 0 || Scans > scans )
+      Scans = scans;
+  }
+  if ( Scans <= 0 ) {
+    printlog( "! error in ReplayThread::initialize() -> no data to replay in " + Path );
+    finish();
+    return -1;
+  }
+  Position = 0;
+
+  // each grid is replayed from its own trace file:
+  Plan.clear();
+  Plan.setBlockSamples( blockSamples() );
+  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
+    if ( used( g ) ) {
+      for ( int k=0; k<gridChannels( g ); k++ )
+	Plan.add( g, g );
+    }
+  }
+
+  readTimeStamps();
+
+  Samples = 0;
+  MaxSamples = 0;
+  if ( duration > 0.0 )
+    MaxSamples = (long long)ceil( duration*sampleRate() );
+
+  double interval = number( "readinterval" );
+  ReadScans = (int)::ceil( interval*sampleRate() );
+  if ( ReadScans < 1 )
+    ReadScans = 1;
+  Pace.start( Speed > 0.0 ? sampleRate()*Speed : sampleRate(), ReadScans );
+
+  printlog( "ReplayThread replays " + Str( Scans/sampleRate(), "%.1f" ) + "s of " + Path
+	    + ( Speed > 0.0 ? " at " + Str( Speed, "%g" ) + " times real time" : string( " as fast as possible" ) )
+	    + ( Loop ? " in a loop" : "" ) );
+
+  return 0;
+}
+
+
+void ReplayThread::finish( void )
+{
+  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
+    if ( Traces[g] != 0 )
+      munmap( (void *)Traces[g], TraceSize[g] );
+    Traces[g] = 0;
+    TraceSize[g] = 0;
+  }
+}
+
+
+void ReplayThread::readTimeStamps( void )
+{
+  TimeStampScans.clear();
+  TimeStamps.clear();
+  NextTimeStamp = 0;
+  int grid = -1;
+  for ( int g=0; g<ConfigData::MaxGrids && grid < 0; g++ ) {
+    if ( used( g ) )
+      grid = g;
+  }
+  Options tsopt;
+  tsopt.addInteger( "Num" );
+  for ( int g=0; g<ConfigData::MaxGrids; g++ )
+    tsopt.addNumber( "Index"+Str(g+1), "" );
+  tsopt.addDate( "Date" );
+  tsopt.addTime( "Time" );
+  tsopt.addText( "Comment", "" );
+  ifstream tsf( string( Path + "timestamps.dat" ).c_str() );
+  while ( tsf.good() ) {
+    tsopt.setFlags( 0 );
+    tsopt.read( tsf, 0, ":=", "", StrQueue::StopEmpty );
+    if ( tsopt.flags( "Num" ) == 0 )
+      break;
+    TimeStampScans.push_back( (long long)tsopt.number( "Index" + Str(grid+1) )/gridChannels( grid ) );
+    TimeStamps.push_back( Str( tsopt.integer( "Num" ), "%02d" ) + " "
+			  + tsopt.text( "Date" ) + " " + tsopt.text( "Time" ) + " "
+			  + tsopt.text( "Comment" ) );
+  }
+}
+
+
+void ReplayThread::logTimeStamps( long long scan )
+{
+  while ( NextTimeStamp < TimeStampScans.size() &&
+	  TimeStampScans[NextTimeStamp] < scan ) {
+    printlog( "replayed time stamp " + TimeStamps[NextTimeStamp] );
+    NextTimeStamp++;
+  }
+}
+
+
+int ReplayThread::transferScans( long long pos, long long scans )
+{
+  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
+    if ( ! used( g ) )
+      continue;
+    int nc = gridChannels( g );
+    const float *sp = Traces[g] + pos*nc;
+    long long k = 0;
+    while ( k < scans ) {
+      long long n = maxPush( g )/nc;
+      if ( n > scans - k )
+	n = scans - k;
+      if ( n <= 0 ) {
+	printlog( "! error in ReplayThread::read() -> no space for a whole scan in the input buffers" );
+	return -1;
+      }
+      float *dest[ConfigData::MaxGrids];
+      dest[g] = pushBuffer( g, n*nc );
+      Plan.execute( g, sp, n, dest );
+      push( g, n*nc );
+      sp += n*nc;
+      k += n;
+    }
+  }
+  return 0;
+}
+
+
+int ReplayThread::read( void )
+{
+  if ( MaxSamples > 0 && Samples >= MaxSamples )
+    return 1;
+
+  // scans due:
+  long long n = ReadScans;
+  if ( Speed > 0.0 ) {
+    n = Pace.wait() - Samples;
+    if ( Pace.fellBehind() )
+      printlog( "! warning in ReplayThread::read() -> can not keep up with the replay speed" );
+  }
+  if ( MaxSamples > 0 && n > MaxSamples - Samples )
+    n = MaxSamples - Samples;
+
+  // limited by the free space in the input buffers:
+  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
+    if ( used( g ) ) {
+      long long m = inputRing( g ).capacity()/gridChannels( g ) - ReadScans;
+      if ( m < ReadScans )
+	m = ReadScans;
+      if ( n > m )
+	n = m;
+    }
+  }
+
+  while ( n > 0 ) {
+    if ( Position >= Scans ) {
+      if ( ! Loop ) {
+	printlog( "end of replayed recording " + Path );
+	return 1;
+      }
+      printlog( "restart replay of " + Path );
+      Position = 0;
+      NextTimeStamp = 0;
+    }
+    long long m = Scans - Position;
+    if ( m > n )
+      m = n;
+    if ( transferScans( Position, m ) < 0 )
+      return -1;
+    Position += m;
+    Samples += m;
+    n -= m;
+    logTimeStamps( Position );
+  }
+
+  return 0;
+}
+
@@ -26,39 +26,71 @@
 
 SimulationThread::SimulationThread( ConfigData *cd )
   : DataThread( "Simulation", cd ),
-    FixedPos( false )
+    FixedPos( false ),
+    RealTime( true )
 {
   addBoolean( "fixedpos", FixedPos );
+  addBoolean( "realtime", RealTime );
+  addNumber( "readinterval", 0.01, "s" );
 }
 
 
 int SimulationThread::initialize( double duration )
 {
   FixedPos = boolean( "fixedpos" );
+  RealTime = boolean( "realtime" );
 
   Amplitude = 0.0;
 
-  // init sine:
+  // init sine and electrode positions:
   double freq = 900.0;
   for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
     if ( used( g ) ) {
       int n = (int)::rint( sampleRate()/freq );
-      Sine[g].reserve( n );
-      Sine[g].clear();
+      Sine[g].resize( n );
       for ( int k=0; k<n; k++ )
-	Sine[g].push_back( sin( 2.0*M_PI*k/n ) );
+	Sine[g][k] = sin( 2.0*M_PI*k/n );
+      Phase[g] = 0;
+      ChannelX[g].resize( gridChannels( g ) );
+      ChannelY[g].resize( gridChannels( g ) );
+      for ( int r=0; r<rows( g ); r++ ) {
+	for ( int c=0; c<columns( g ); c++ ) {
+	  ChannelX[g][r*columns( g )+c] = c;
+	  ChannelY[g][r*columns( g )+c] = r;
+	}
+      }
+      Gains[g].assign( gridChannels( g ), 0.0 );
       X[g] = 0.5*columns( g );
       Y[g] = 0.5*rows( g );
+      WalkScans[g] = 0;
       freq += 50.0;
     }
   }
 
+  // raw data are quantized with 16 bit over twice the maximum voltage:
+  if ( rawInput() ) {
+    double coeffs[2] = { 0.0, 2.0*maxVolts()/65536.0 };
+    for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
+      if ( used( g ) ) {
+	for ( int c=0; c<gridChannels( g ); c++ )
+	  setCalibration( g, c, 1, 32768.0, coeffs );
+      }
+    }
+  }
+
   Samples = 0;
   MaxSamples = 0;
   if ( duration > 0.0 )
-    MaxSamples = (int)ceil( duration*sampleRate() );
+    MaxSamples = (long long)ceil( duration*sampleRate() );
 
-  printlog( "SimulationThread 10ms" );
+  double interval = number( "readinterval" );
+  ReadScans = (int)::ceil( interval*sampleRate() );
+  if ( ReadScans < 1 )
+    ReadScans = 1;
+  Pace.start( sampleRate(), ReadScans );
+
+  printlog( "SimulationThread interval=" + Str( 1000.0*ReadScans/sampleRate() ) + "ms"
+	    + ( RealTime ? " in real time" : " as fast as possible" ) );
 
   return 0;
 }
@@ -66,95 +98,163 @@ int SimulationThread::initialize( double duration )
 
 void SimulationThread::finish( void )
 {
-  for ( int g=0; g<ConfigData::MaxGrids; g++ )
+  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
     Sine[g].clear();
+    Gains[g].clear();
+    ChannelX[g].clear();
+    ChannelY[g].clear();
+  }
 }
 
 
-int SimulationThread::read( void )
+void SimulationThread::updateGains( int g, int n )
 {
-  if ( MaxSamples > 0 && Samples >= MaxSamples )
-    return 1;
+  float *gp = &Gains[g][0];
+  int nc = gridChannels( g );
 
-  bool firstgrid = true;
-  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
-    if ( used( g ) ) {
+  if ( FixedPos ) {
+    for ( int c=0; c<nc; c++ )
+      gp[c] = 0.0;
+    gp[(rows( g )/2)*columns( g ) + columns( g )/2] = Amplitude;
+    return;
+  }
 
-      int n = (int)::floor( 0.01*sampleRate() ) / Sine[g].size();
-      double buffer[n*gridChannels( g )*Sine[g].size()];
-      int buffern = 0;
-
-      if ( FixedPos ) {
-	for ( int k=0; k<n; k++ ) {
-	  for ( unsigned int j = 0; j<Sine[g].size(); j++ ) {
-	    for ( int r=0; r<rows( g ); r++ ) {
-	      for ( int c=0; c<columns( g ); c++ ) {
-		if ( r == rows( g )/2 && c == columns( g )/2 )
-		  buffer[buffern++] = Amplitude*Sine[g][j];
-		else
-		  buffer[buffern++] = 0.0;
-	      }
-	    }
-	  }
-	  Amplitude += 0.0001;
-	  if ( Amplitude > maxVolts() )
-	    Amplitude = 0.0;
-	  if ( firstgrid )
-	    Samples++;
-	}
-      }
+  // the fish takes a step of its random walk every period of the waveform,
+  // the remaining scans count for the next step:
+  int nw = Sine[g].size();
+  int steps = ( WalkScans[g] + n ) / nw;
+  WalkScans[g] = ( WalkScans[g] + n ) % nw;
+
+  // all steps of the random walk at once:
+  double a = 1.0 - 1.0/Tau;
+  double an = ::pow( a, steps );
+  double sd = ::sqrt( (1.0-an*an)/(1.0-a*a) )/Tau;
+  X[g] = 0.5*columns( g ) + an*(X[g] - 0.5*columns( g )) + sd*D*columns( g )*rnd.gaussian();
+  if ( X[g] >= 1.0+columns( g ) )
+    X[g] = 1.0+columns( g );
+  else if ( X[g] < 0.0 )
+    X[g] = 0.0;
+  Y[g] = 0.5*rows( g ) + an*(Y[g] - 0.5*rows( g )) + sd*D*rows( g )*rnd.gaussian();
+  if ( Y[g] >= 1.0+rows( g ) )
+    Y[g] = 1.0+rows( g );
+  else if ( Y[g] < 0.0 )
+    Y[g] = 0.0;
 
-      else {
-	for ( int k=0; k<n; k++ ) {
-	  X[g] += (0.5*columns( g ) + D*columns( g )*rnd.gaussian() - X[g])/Tau;
-	  if ( X[g] >= 1.0+columns( g ) )
-	    X[g] = 1.0+columns( g );
-	  else if ( X[g] < 0.0 )
-	    X[g] = 0.0;
-	  Y[g] += (0.5*rows( g ) + D*rows( g )*rnd.gaussian() - Y[g])/Tau;
-	  if ( Y[g] >= 1.0+rows( g ) )
-	    Y[g] = 1.0+rows( g );
-	  else if ( Y[g] < 0.0 )
-	    Y[g] = 0.0;
-	  for ( unsigned int j = 0; j<Sine[g].size(); j++ ) {
-	    for ( int r=0; r<rows( g ); r++ ) {
-	      for ( int c=0; c<columns( g ); c++ ) {
-		double dx = X[g]-c;
-		double dy = Y[g]-r;
-		double r = dx*dx + dy*dy;
-		float a = maxVolts()*0.1/r;
-		if ( a > maxVolts() )
-		  a = maxVolts();
-		buffer[buffern++] = a*Sine[g][j];
-	      }
-	    }
-	  }
+  // gains of all channels, vectorizable:
+  float x = X[g];
+  float y = Y[g];
+  float maxvolts = maxVolts();
+  float amplitude = 0.1*maxVolts();
+  const float *xp = &ChannelX[g][0];
+  const float *yp = &ChannelY[g][0];
+  for ( int c=0; c<nc; c++ ) {
+    float dx = x - xp[c];
+    float dy = y - yp[c];
+    float ga = amplitude/(dx*dx + dy*dy);
+    gp[c] = ga < maxvolts ? ga : maxvolts;
+  }
+}
+
+
+int SimulationThread::generate( int g, int n )
+{
+  int nc = gridChannels( g );
+  const float *wp = &Sine[g][0];
+  int nw = Sine[g].size();
+  int k = 0;
+  while ( k < n ) {
+    int m = maxPush( g )/nc;
+    if ( m > n - k )
+      m = n - k;
+    if ( m <= 0 ) {
+      printlog( "! error in SimulationThread::read() -> no space for a whole scan in the input buffers" );
+      return -1;
+    }
+    int ph = Phase[g];
+    int ss = scanStride( g );
+    int cs = channelStride();
+    if ( rawInput() ) {
+      float scale = 65536.0/2.0/maxVolts();
+      RawGains.resize( nc );
+      float *gains = &RawGains[0];
+      for ( int c=0; c<nc; c++ )
+	gains[c] = Gains[g][c]*scale;
+      RawSample *rp = rawPushBuffer( g, m*nc );
+      for ( int s=0; s<m; s++ ) {
+	float w = wp[ph];
+	for ( int c=0; c<nc; c++ ) {
+	  float v = gains[c]*w + 32768.5F;
+	  v = v < 0.0F ? 0.0F : ( v > 65535.0F ? 65535.0F : v );
+	  rp[c*cs] = (RawSample)v;
 	}
+	rp += ss;
+	if ( ++ph >= nw )
+	  ph = 0;
+      }
+    }
+    else {
+      const float *gp = &Gains[g][0];
+      float *fp = pushBuffer( g, m*nc );
+      for ( int s=0; s<m; s++ ) {
+	float w = wp[ph];
+	for ( int c=0; c<nc; c++ )
+	  fp[c*cs] = gp[c]*w;
+	fp += ss;
+	if ( ++ph >= nw )
+	  ph = 0;
       }
+    }
+    Phase[g] = ph;
+    push( g, m*nc );
+    k += m;
+  }
+  return 0;
+}
 
-      // transfer data to input buffer:
-      int bufferinx = 0;
-      do {
-	int pn = 0;
-	int m = inputBuffer( g ).maxPush();
-	float *fp = inputBuffer( g ).pushBuffer();
-	while ( m > 0 && bufferinx < buffern ) {
-	  *(fp++) = (float)buffer[bufferinx++];
-	  pn++;
-	  m--;
-	}
-	lockAI( g );
-	inputBuffer( g ).push( pn );
-	unlockAI( g );
-      } while ( bufferinx < buffern );
 
-      firstgrid = false;
+int SimulationThread::read( void )
+{
+  if ( MaxSamples > 0 && Samples >= MaxSamples )
+    return 1;
 
+  // scans due:
+  long long n = ReadScans;
+  if ( RealTime ) {
+    n = Pace.wait() - Samples;
+    if ( Pace.fellBehind() )
+      printlog( "! warning in SimulationThread::read() -> can not keep up with real time" );
+  }
+  if ( MaxSamples > 0 && n > MaxSamples - Samples )
+    n = MaxSamples - Samples;
+
+  // limited by the free space in the input buffers:
+  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
+    if ( used( g ) ) {
+      long long m = inputRing( g ).capacity()/gridChannels( g ) - ReadScans;
+      if ( m < ReadScans )
+	m = ReadScans;
+      if ( n > m )
+	n = m;
     }
   }
 
-  QThread::msleep( (int)::floor( 1000.0*0.01 ) );
+  int firstgrid = -1;
+  for ( int g=0; g<ConfigData::MaxGrids; g++ ) {
+    if ( used( g ) ) {
+      if ( firstgrid < 0 )
+	firstgrid = g;
+      updateGains( g, n );
+      if ( generate( g, n ) < 0 )
+	return -1;
+    }
+  }
+
+  if ( FixedPos && firstgrid >= 0 ) {
+    Amplitude += 0.0001*n/Sine[firstgrid].size();
+    if ( Amplitude > maxVolts() )
+      Amplitude = 0.0;
+  }
+  Samples += n;
 
   return 0;
 }
-
@@ -35,6 +35,9 @@
 #ifdef HAVE_NIDAQMXBASE_H
 #include "nidaqmxthread.h"
 #endif
+#ifdef HAVE_LIBUSB_1_0_LIBUSB_H
+#include "daqflexthread.h"
+#endif
 #include "stepper.h"
 
 using namespace std;
@@ -156,6 +159,10 @@ Stepper::Stepper( double samplerate,
 #else
 #ifdef HAVE_NIDAQMXBASE_H
   acq = new NIDAQmxThread( this );
+#else
+#ifdef HAVE_LIBUSB_1_0_LIBUSB_H
+  acq = new DAQFlexThread( this );
+#endif
 #endif
 #endif
   if ( acq == 0 || simulate ) {